@@ -0,0 +1,87 @@
+#pragma once
+#include "Hal.h"
+
+// Zero-copy CSV helpers: fields are (ptr, len) views into the caller's line
+// buffer, nothing is allocated. Comma or semicolon, simple quotes (no
+// escaped quotes, no embedded newlines).
+
+struct CsvField {
+  const char* p;
+  uint16_t len;
+};
+
+// Trim \r and trailing spaces/tabs, returns the new length
+inline size_t csvRstrip(const char* s, size_t len) {
+  while (len && (s[len - 1] == '\r' || s[len - 1] == ' ' || s[len - 1] == '\t')) len--;
+  return len;
+}
+
+// Detect delimiter from the header line
+inline char csvDetectDelim(const char* s, size_t len) {
+  int c = 0, sc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (s[i] == ',') c++;
+    if (s[i] == ';') sc++;
+  }
+  return (sc > c) ? ';' : ',';
+}
+
+// Split one line into at most maxFields views; returns the field count.
+// Surrounding quotes are stripped from the views.
+inline size_t csvSplit(const char* s, size_t len, char delim, CsvField* out, size_t maxFields) {
+  size_t n = 0, start = 0;
+  bool inQuotes = false;
+  for (size_t i = 0; i <= len && n < maxFields; ++i) {
+    if (i < len && s[i] == '"') { inQuotes = !inQuotes; continue; }
+    if (i < len && (inQuotes || s[i] != delim)) continue;
+    size_t a = start, b = i;
+    while (a < b && s[a] == ' ') a++;
+    while (b > a && s[b - 1] == ' ') b--;
+    if (b - a >= 2 && s[a] == '"' && s[b - 1] == '"') { a++; b--; }
+    out[n++] = { s + a, (uint16_t)(b - a) };
+    start = i + 1;
+  }
+  return n;
+}
+
+// Case-insensitive "field starts with prefix"
+inline bool csvStartsWith(const CsvField& f, const char* prefix) {
+  size_t k = strlen(prefix);
+  return f.len >= k && strncasecmp(f.p, prefix, k) == 0;
+}
+
+inline bool csvEquals(const CsvField& f, const char* s) {
+  return strlen(s) == f.len && strncasecmp(f.p, s, f.len) == 0;
+}
+
+// Integer straight from the field text (no temporary String)
+inline long csvToLong(const CsvField& f) {
+  long v = 0;
+  size_t i = 0;
+  bool neg = (f.len && f.p[0] == '-');
+  if (neg || (f.len && f.p[0] == '+')) i++;
+  for (; i < f.len && f.p[i] >= '0' && f.p[i] <= '9'; ++i) v = v * 10 + (f.p[i] - '0');
+  return neg ? -v : v;
+}
+
+// Decimal text -> hundredths, digit by digit (third decimal rounds).
+// "1.5" -> 150, "-0.125" -> -13
+inline int32_t csvToCenti(const CsvField& f) {
+  int64_t v = 0;
+  size_t i = 0;
+  bool neg = (f.len && f.p[0] == '-');
+  if (neg || (f.len && f.p[0] == '+')) i++;
+  for (; i < f.len && f.p[i] >= '0' && f.p[i] <= '9'; ++i) v = v * 10 + (f.p[i] - '0');
+  v *= 100;
+  if (i < f.len && f.p[i] == '.') {
+    i++;
+    int scale = 10;
+    for (; i < f.len && f.p[i] >= '0' && f.p[i] <= '9'; ++i) {
+      int d = f.p[i] - '0';
+      if (scale >= 1) v += d * scale;
+      else { if (d >= 5) v += 1; break; }
+      scale /= 10;
+    }
+  }
+  return (int32_t)(neg ? -v : v);
+}
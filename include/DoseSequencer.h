@@ -0,0 +1,34 @@
+#pragma once
+#include "Hal.h"
+#include "Settings.h"
+
+// Queue between the scheduler and the pumps. Doses start when the
+// concurrency limit, the supply current budget, the start stagger and the
+// gap between incompatible additives all allow it. At most one job waits
+// per pump: a new request for a pump that already has one is merged into
+// it, so the queue cannot overflow. Manual run/prime/purge commands do not
+// come through here: they start at once, outside these limits, though the
+// pumps they run still count against the budget for queued doses.
+
+struct DoseJob {
+  float ml = 0.0f;           // 0 = no job waiting
+  uint32_t queuedMs = 0;     // FIFO order among waiting jobs
+  uint32_t due[MAX_TIMES_PER_DAY] = {};   // scheduled occurrence per slot this dose covers (0 = none)
+};
+
+class DoseSequencer {
+public:
+  // due: per slot, the scheduled occurrence the dose stands for (nullptr for
+  // manual doses); the scheduler records those as fired once the dose starts
+  void enqueue(uint8_t pump, float ml, const uint32_t *due = nullptr);
+  void loop();                               // start whatever may start now
+  float pendingMl(uint8_t pump) const { return (pump < NUM_PUMPS) ? _jobs[pump].ml : 0.0f; }
+
+private:
+  DoseJob _jobs[NUM_PUMPS];
+  uint32_t _lastStartMs = 0;
+
+  bool mayStart(uint8_t pump, uint32_t now) const;
+};
+
+extern DoseSequencer sequencer;
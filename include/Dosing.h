@@ -0,0 +1,22 @@
+#pragma once
+#include "Hal.h"
+#include "Settings.h"
+
+// Flow model and dose planning. Flow vs. duty comes from the pump's
+// calibration table (piecewise linear, through 0 ml/s at duty 0); without
+// a table it is mlPerSec at the configured duty, linear in duty.
+
+// A dose as a trapezoid: rise over riseMs, hold at duty, fall over fallMs
+struct DosePlan {
+  uint8_t duty;
+  uint32_t riseMs;
+  uint32_t holdMs;
+  uint32_t fallMs;
+  float flowMlps;     // flow at duty
+  uint32_t totalMs() const { return riseMs + holdMs + fallMs; }
+};
+
+float flowAt(const PumpConfig &pc, uint8_t duty);        // ml/s
+// ml of a run of totalMs at peak duty with these edges, stepped as PwmRamp steps it
+float runMl(const PumpConfig &pc, uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs);
+DosePlan planDose(const PumpConfig &pc, float ml);        // totalMs() == 0 if ml cannot be dosed
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+// Thin hardware seam for the scheduler, pump control, dosing and log code.
+// The device build implements it in src/Hal.cpp on top of the Arduino
+// core, Ticker and LittleFS; [env:native] links src/host/HalHost.cpp (fake
+// clock, recorded PWM writes, FS on a directory) without touching callers.
+// Everything here is a plain function or type alias, so the device pays no
+// indirection.
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <FS.h>
+#include <Ticker.h>
+namespace hal {
+  using File = fs::File;
+  using Dir = fs::Dir;
+  using FS = fs::FS;
+  using Timer = Ticker;         // one-shot callbacks (os_timer, run from the SYS task)
+}
+#else
+#include "host/HalHost.h"
+#endif
+
+namespace hal {
+  // clock
+  uint32_t millis();
+  uint32_t micros();
+  time_t now();                 // wall clock, epoch seconds (< 100000 until synced)
+  uint32_t cycles();            // CPU cycle counter (wraps every ~26 s at 160 MHz)
+  uint32_t cpuMHz();
+  void sleepMs(uint32_t ms);    // idle wait (the host clock just moves on)
+  void yield();                 // let WiFi/SYS run inside long loops
+
+  // GPIO / PWM (8-bit duty)
+  void pinOutput(uint8_t pin);
+  void pinWrite(uint8_t pin, bool high);
+  void pwmSetup(uint8_t ch, uint8_t pin, uint32_t freqHz);
+  void pwmWrite(uint8_t ch, uint8_t pin, uint8_t duty);
+
+  void console(const char *line);   // Serial on the device, stdout on the host
+
+  // filesystem the log, settings and fire state live on (must be mounted)
+  FS &fs();
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <Arduino.h>
+
+// Heap health, sampled from the main loop; served on /api/heap
+struct HeapInfo {
+  uint32_t freeBytes;
+  uint32_t maxBlock;      // largest allocation that can still succeed
+  uint8_t fragPct;        // 100 - 100 * maxBlock / free (core's heap fragmentation metric)
+};
+
+namespace HeapStats {
+  void sample();          // fold the current values into the watermarks
+  HeapInfo now();
+  HeapInfo worst();       // lowest free / max block and highest fragmentation since boot
+  uint32_t samples();
+}
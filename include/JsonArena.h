@@ -0,0 +1,30 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// ArduinoJson allocator over a caller-owned fixed buffer. Allocation bumps
+// a pointer; the most recent block can grow, shrink or be freed in place,
+// which is all the parser needs to build strings without waste. Other
+// frees are only reclaimed by reset(). Running out returns nullptr, which
+// ArduinoJson reports as NoMemory instead of touching the heap.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  JsonArena(void *buf, size_t cap);
+
+  void *allocate(size_t size) override;
+  void deallocate(void *ptr) override;
+  void *reallocate(void *ptr, size_t newSize) override;
+
+  void reset();                          // forget every block (no document may still use it)
+  size_t used() const { return _top; }
+  size_t peak() const { return _peak; }  // high-water mark since construction
+  size_t capacity() const { return _cap; }
+
+private:
+  static constexpr size_t kNone = SIZE_MAX;
+  uint8_t *_buf;
+  size_t _cap;
+  size_t _top = 0;        // first free byte
+  size_t _last = kNone;   // header offset of the most recent live block
+  size_t _peak = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "JsonArena.h"
+
+// Preallocated JSON arenas and output buffers for the REST and WebSocket
+// handlers. A handler borrows a slot for one request instead of building a
+// heap JsonDocument and String every time, so a browser polling at 1 Hz
+// does not fragment the heap. With every slot out, a lease takes one
+// block of the same size from the heap (counted as a miss).
+#ifndef JSON_POOL_SLOTS
+#define JSON_POOL_SLOTS 2
+#endif
+#ifndef JSON_POOL_ARENA
+#define JSON_POOL_ARENA 1536
+#endif
+#ifndef JSON_POOL_OUT
+#define JSON_POOL_OUT 1536
+#endif
+
+struct JsonPoolStats {
+  uint8_t inUse, inUseMax;   // slots borrowed now / most at once
+  uint32_t leases;           // borrows served from the pool
+  uint32_t misses;           // leases that had to use the heap
+  uint32_t spills;           // outputs too long for the slot (went to a String)
+  uint16_t arenaPeak;        // most arena bytes one document used
+  uint16_t outPeak;          // longest output that fitted
+};
+
+class JsonLease {
+public:
+  JsonLease();
+  ~JsonLease();
+  JsonLease(const JsonLease &) = delete;
+  JsonLease &operator=(const JsonLease &) = delete;
+
+  JsonDocument &doc() { return _doc; }
+  size_t serialize();                      // doc() -> out(), returns the length
+  const char *out() const { return _spill.length() ? _spill.c_str() : _out; }
+  size_t outLen() const { return _outLen; }
+
+private:
+  int8_t _slot;                            // -1: block is from the heap
+  uint8_t *_block;
+  JsonArena _arena;
+  JsonDocument _doc;
+  char *_out;
+  size_t _outLen = 0;
+  String _spill;
+};
+
+namespace JsonPool {
+  JsonPoolStats stats();
+}
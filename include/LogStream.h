@@ -0,0 +1,114 @@
+#pragma once
+#include "Hal.h"
+#include "Logger.h"
+#include "Trace.h"
+
+// Resumable render state for one chunked log response. Each TCP chunk is
+// filled on demand from the reader's cursor, so heap use is this struct
+// (~0.9 KB) however big the log is. The records on flash come first, then
+// the ones still queued in RAM, read from the queue: the handler never
+// flushes, so flash appends stay in the log task's idle slot. Records
+// appended after the response started are not included; if the segment
+// being read is rotated away mid-response the output simply ends early.
+struct LogStream {
+  LogReader rd;
+  LogQuery q;
+  bool json = false;
+  bool first = true;
+  uint8_t phase = 0;            // 0 prologue, 1 flash records, 2 queued records, 3 epilogue, 4 done
+  uint32_t next = 0;            // next record index to look at
+  uint32_t seq = 0, seqEnd = 0; // queued records still to look at: seqs [seq, seqEnd)
+  uint32_t skip = 0;            // queued matches older than the newest q.last
+  char line[256];
+  uint16_t lineLen = 0, lineOff = 0;   // rendered text not yet handed out
+
+  LogStream(bool asJson, const LogQuery& query) : q(query), json(asJson) {
+    seqEnd = Logger::nextSeq();
+    seq = seqEnd - Logger::queueStats().depth;
+    const bool onFlash = rd.open();
+    if (q.last) {   // the newest matches may all still be queued
+      uint32_t queued = 0;
+      LogRecord r;
+      for (uint32_t s = seq; s < seqEnd; ++s) queued += Logger::queued(s, r) && q.matches(r);
+      skip = (queued > q.last) ? queued - q.last : 0;
+      next = (queued >= q.last || !onFlash) ? rd.size() : Logger::tailStart(rd, q.last - queued, q);
+    } else if (onFlash) {
+      next = Logger::seekTime(q.from);
+    }
+  }
+
+  // Queued record `s`, or where it went if the log task flushed it since:
+  // the newest records on flash
+  bool queuedRecord(uint32_t s, LogRecord &r) {
+    if (Logger::queued(s, r)) return true;
+    const uint32_t flashedEnd = Logger::nextSeq() - Logger::queueStats().depth;
+    rd.close();
+    if (!rd.open() || flashedEnd - s > rd.size()) return false;
+    return rd.read(rd.size() - (flashedEnd - s), r) && r.seq == s;
+  }
+
+  void render(const LogRecord &r) {
+    size_t n = 0;
+    if (json) {
+      n = strlcpy(line, first ? "  " : ",\n  ", sizeof(line));
+      n += Logger::formatJson(r, line + n, sizeof(line) - n);
+    } else {
+      n = Logger::formatCsv(r, line, sizeof(line));
+    }
+    first = false;
+    lineLen = (uint16_t)n;
+  }
+
+  // Render the next piece of output into line; false once everything is out.
+  bool produce() {
+    lineOff = lineLen = 0;
+    LogRecord r;
+    switch (phase) {
+      case 0:
+        phase = 1;
+        lineLen = (uint16_t)strlcpy(line, json ? "[\n" : Logger::csvHeader(), sizeof(line));
+        return true;
+      case 1:
+        while (next < rd.size() && rd.read(next, r)) {
+          next++;
+          if (r.ts > q.to) { seq = seqEnd; break; }   // queued ones are newer still
+          if (!q.matches(r)) continue;
+          render(r);
+          return true;
+        }
+        phase = 2;
+        // fall through
+      case 2:
+        while (seq < seqEnd) {
+          if (!queuedRecord(seq++, r) || !q.matches(r)) continue;
+          if (skip) { skip--; continue; }
+          render(r);
+          return true;
+        }
+        phase = 3;
+        // fall through
+      case 3:
+        phase = 4;
+        rd.close();
+        if (!json) return false;
+        lineLen = (uint16_t)strlcpy(line, "\n]\n", sizeof(line));
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // AwsResponseFiller body: returning 0 ends the response
+  size_t fill(uint8_t* buf, size_t maxLen) {
+    TRACE_SCOPE("log.stream.fill");
+    size_t out = 0;
+    while (out < maxLen) {
+      if (lineOff >= lineLen && !produce()) break;
+      size_t n = min<size_t>(lineLen - lineOff, maxLen - out);
+      memcpy(buf + out, line + lineOff, n);
+      lineOff += n;
+      out += n;
+    }
+    return out;
+  }
+};
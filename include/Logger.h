@@ -1,17 +1,102 @@
 #pragma once
-#include <Arduino.h>
+#include "Hal.h"
 
+// Event / status codes stored in the binary log. The text names are only
+// produced when the log is rendered back to CSV/JSON.
+enum class LogEvent : uint8_t { Info = 0, Run, Prime, Purge, Stop };
+enum class LogStatus : uint8_t { None = 0, SetupComplete };
+
+// One fixed-width record of the dose log. Columns the old CSV printed with
+// "%.2f" are kept as hundredths so rendering reproduces them exactly.
+struct __attribute__((packed)) LogRecord {
+  uint32_t seq;       // write counter
+  uint32_t ts;        // epoch seconds
+  uint32_t uptimeMs;
+  int32_t  runtimeC;  // runtime * 100
+  int32_t  mlC;       // ml * 100
+  uint16_t mlpsC;     // mlps * 100
+  int16_t  pump;
+  uint8_t  duty;
+  int8_t   dir;
+  uint8_t  event;     // LogEvent
+  uint8_t  status;    // LogStatus
+  int32_t  overUs;    // timed stop: how late the PWM was cut, in microseconds
+};
+static_assert(sizeof(LogRecord) == 32, "LogRecord layout changed, bump kLogVersion");
+
+// Record filter for the log endpoints. from/to are epoch seconds
+// (inclusive); pump/event of -1 match anything; last > 0 keeps only the
+// newest `last` matches.
+struct LogQuery {
+  uint32_t from = 0, to = UINT32_MAX;
+  int16_t pump = -1;
+  int16_t event = -1;
+  uint32_t last = 0;
+  bool matches(const LogRecord &r) const {
+    return r.ts >= from && r.ts <= to && (pump < 0 || r.pump == pump) && (event < 0 || r.event == event);
+  }
+};
+
+// Reader over the segment chain; i = 0 is the oldest record. Records are
+// pulled in ~512 B blocks, forwards with read() or backwards with readBack().
+// Works on a snapshot of the record count taken in open().
+class LogReader {
+public:
+  bool open();                       // false if there is no log yet
+  void close();
+  uint32_t size() const { return _count; }
+  bool read(uint32_t i, LogRecord &out);
+  bool readBack(uint32_t i, LogRecord &out);
+
+private:
+  static constexpr uint8_t kBufRecs = 16;   // 16 * 32 B = 512 B
+  bool fill(uint32_t first);
+  hal::File _f;
+  uint32_t _count = 0;
+  uint16_t _firstSeg = 0;
+  int32_t  _seg = -1;                // segment index (from oldest) _f has open
+  uint32_t _bufIdx = 0;              // record index of _buf[0]
+  uint8_t  _bufLen = 0;
+  LogRecord _buf[kBufRecs];
+};
+
+// Write-queue counters, reported in /api/status
+struct LogQueueStats {
+  uint16_t depth;        // records waiting in RAM
+  uint32_t dropped;      // records lost because the queue was full
+  uint32_t flushes;
+  uint32_t lastFlushUs;  // duration of the most recent flush
+  uint32_t maxFlushUs;
+};
 
 namespace Logger {
-  void begin();                               // ensure header exists (FS must be mounted)
-  bool clear();                                // wipe & recreate header
-  bool exists();                               // does /logs.csv exist?
-  String tail(size_t maxLines);                // last N lines (text)
+  void begin();                               // recover the segment chain (FS must be mounted)
+  bool clear();                                // delete all segments, start a new one
+  bool exists();                               // is there a log file?
+  uint32_t tailStart(LogReader &rd, size_t n, const LogQuery &q); // first index of the latest n matches
+  uint32_t seekTime(uint32_t from);            // first record index that can have ts >= from (sparse index)
+
+  // Queues the record in RAM; it reaches flash on the next flush.
+  void logEvent(LogEvent event, int pump, float runtime, float mlps, float ml, int duty, int direction,
+                LogStatus status = LogStatus::None, int32_t overUs = 0);
+  void loop(bool idle);                        // flush when the batch/latency limits are hit
+  void flush();                                // write everything queued (call before restart/OTA)
+  LogQueueStats queueStats();
+  // Read-only view of the RAM queue, for readers that must not flush: seqs
+  // [nextSeq() - depth, nextSeq()) are queued; queued() is false once a
+  // record has been flushed (it is then the newest on flash)
+  uint32_t nextSeq();
+  bool queued(uint32_t seq, LogRecord &out);
 
-  void logEvent(const char* event, int pump, float runtime, float mlps,float ml, int duty, int direction, const char* status = "--");
+  // Text rendering, used by the HTTP routes. Return bytes written (0 if cap is too small).
+  const char* csvHeader();                     // "ts,uptime_ms,...,status\n"
+  size_t formatCsv(const LogRecord &r, char *out, size_t cap);
+  size_t formatJson(const LogRecord &r, char *out, size_t cap);
+  const char* eventName(uint8_t code);
+  const char* statusName(uint8_t code);
+  int eventCode(const char* name);             // case-insensitive, -1 if unknown
 }
 
-void ensureHeader();
 void logInfo(const char *fmt, ...);
 void logWarn(const char *fmt, ...);
 void logErr (const char *fmt, ...);
@@ -1,5 +1,5 @@
 #pragma once
-#include <Arduino.h>
+#include "Hal.h"
 #include "Settings.h"
 
 // Map each pump to DRV8871 pins (PWM + DIR). Adjust to your wiring.
@@ -14,6 +14,14 @@ struct PumpRuntime {
   uint32_t startMs = 0;
   uint32_t durMs = 0;
   float deliveredML = 0.0f;
+  uint32_t startUs = 0;
+  volatile bool cutPending = false;   // stop timer cut the PWM, loop() has not finished the stop yet
+  volatile uint32_t cutUs = 0;        // micros() at the cut
+  int32_t overshootUs = 0;            // last timed stop: cut time minus target
+  uint8_t duty = 0;                   // duty currently applied (the ramp steps it)
+  uint32_t lastIntUs = 0;             // deliveredML is integrated up to here
+  float targetML = 0.0f;
+  uint32_t stopMs = 0;                // millis() at the last stop (0 = never ran)
 };
 
 class PumpControl {
@@ -24,9 +32,14 @@ public:
   void run(uint8_t idx, uint16_t seconds);
   void prime(uint8_t idx, uint16_t seconds);
   void purge(uint8_t idx, uint16_t seconds);
+  // Deliver ml using the calibration table and ramp profile, ms resolution; false if it cannot be dosed
+  bool dose(uint8_t idx, float ml);
 
   void stop(uint8_t idx);
   bool isRunning(uint8_t idx) const;
+  bool anyRunning() const;
+  void cutFromTimer(uint8_t idx);   // stop timer callback only: PWM off + timestamp
+  void applyDuty(uint8_t idx, uint8_t duty, uint32_t nowUs);   // ramp callback only
   const PumpRuntime& state(uint8_t idx) const { return _state[idx];
 
    }
@@ -36,8 +49,12 @@ private:
   PumpPins _pins[NUM_PUMPS];
   PumpRuntime _state[NUM_PUMPS];
 
-  void startPump(uint8_t idx, bool reverse, uint16_t seconds);
+  // Every run goes through the ramp; riseMs/fallMs 0 give hard edges
+  void startPump(uint8_t idx, bool reverse, uint32_t durMs, uint8_t duty, uint32_t riseMs, uint32_t fallMs);
   void writePump(uint8_t idx, bool on, bool reverse);
+  void writeDuty(uint8_t idx, uint8_t duty, bool reverse);
+  void integrate(uint8_t idx, uint32_t nowUs);
+  void finishStop(uint8_t idx, bool timed);
 };
 
 extern PumpControl pumpCtl;
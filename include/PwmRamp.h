@@ -0,0 +1,39 @@
+#pragma once
+#include "Hal.h"
+#include "Settings.h"
+
+#ifndef RAMP_STEP_MS
+#define RAMP_STEP_MS 5    // duty update interval while a channel is rising or falling
+#endif
+
+// Soft start/stop generator for the pump PWM channels. A run is a
+// trapezoid: 0 -> peak over riseMs, hold, peak -> 0 over fallMs, ending at
+// totalMs. Steps come from a Ticker (os_timer), not loop(); while every
+// active channel is holding, the timer sleeps until the next fall starts.
+// Each duty change goes through the apply callback with its timestamp so
+// the owner can account volume for the exact duty that was on the wire.
+class PwmRamp {
+public:
+  typedef void (*Apply)(uint8_t ch, uint8_t duty, uint32_t nowUs);
+
+  void begin(Apply apply) { _apply = apply; }
+  // Applies the first duty (0, or peak when riseMs is 0) before returning
+  void start(uint8_t ch, uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs, uint32_t startUs);
+  void cancel(uint8_t ch);              // stop stepping; the caller owns the output
+  void step();                          // timer callback
+
+  // Duty of the trapezoid tMs into the run (used for planning as well)
+  static uint8_t dutyAt(uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs, uint32_t tMs);
+
+private:
+  struct Channel {
+    bool active = false;
+    uint8_t peak = 0, duty = 0;
+    uint32_t riseMs = 0, fallMs = 0, totalMs = 0, startUs = 0;
+  };
+  Channel _ch[NUM_PUMPS];
+  hal::Timer _timer;
+  Apply _apply = nullptr;
+
+  void arm(uint32_t nowUs);
+};
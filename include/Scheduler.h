@@ -1,27 +1,57 @@
 #pragma once
-#include <Arduino.h>
+#include "Hal.h"
 #include <time.h>
 #include "Settings.h"
 
-struct ScheduleFireState {
-  int lastDay = -1;        // day-of-year when we last fired this index
-  uint32_t lastFireMs = 0; // debounce against duplicate triggers
+// One upcoming dose: pump/slot and the wall-clock second it is due
+struct DoseEvent {
+  uint32_t due;   // epoch seconds
+  uint8_t pump;
+  uint8_t slot;
 };
 
 class Scheduler {
 public:
-  void begin();
-  void loop(); // checks time-of-day and fires events
+  void begin();         // loads the persisted fire state (FS must be mounted)
+  void loop();          // cheap unless the head of the timeline is due
+  void invalidate();    // schedule settings changed: rebuild on the next loop()
+  void invalidate(uint8_t pump);   // only that pump's schedule changed: re-plan just its slots
 
-  // compute next run (seconds until next event for a pump), UINT32_MAX if none
+  // seconds until next event for a pump, UINT32_MAX if none (O(1))
   uint32_t nextRunSec(uint8_t pumpIdx) const;
+  // ms until the earliest event, UINT32_MAX if nothing is scheduled
+  uint32_t msUntilNext() const;
+
+  // The dose for that occurrence started (called by the sequencer): persist it
+  void commitFired(uint8_t pump, uint8_t slot, uint32_t due);
 
 private:
-  mutable ScheduleFireState _fired[NUM_PUMPS][MAX_TIMES_PER_DAY];
+  // Sorted by due; holds the next occurrence of every configured slot
+  DoseEvent _timeline[NUM_PUMPS * MAX_TIMES_PER_DAY];
+  uint8_t _count = 0;
+  bool _dirty = true;
+  uint8_t _dirtyPumps = 0;                            // bit p: re-plan pump p's slots
+  bool _reconciled = false;                           // boot catch-up done
+  int _builtYday = -1;                                // local day the timeline was built on
+  uint32_t _nextDue[NUM_PUMPS] = {};                  // 0 = nothing scheduled
+  uint32_t _lastFired[NUM_PUMPS][MAX_TIMES_PER_DAY] = {};   // epoch of the occurrence last handled (queued or done)
+  uint32_t _savedFired[NUM_PUMPS][MAX_TIMES_PER_DAY] = {};  // ...and last started or skipped (persisted)
+  uint16_t _stateRecs = 0;                            // records in the fire-state file
 
   bool timeNow(struct tm &out, time_t &epoch) const;
-  uint16_t secondsSinceMidnight(const struct tm &tmNow) const;
-  void tryFire(uint8_t pumpIdx, uint16_t nowSec, int yday);
+  void rebuild(time_t now, const struct tm &tmNow);
+  void replan(time_t now, const struct tm &tmNow);
+  void planPump(uint8_t pump, uint32_t now, const struct tm &tmNow);
+  void reconcile(uint32_t now, const struct tm &tmNow);
+  void insert(const DoseEvent &ev);
+  void refreshNextDue();
+  float catchUpMl(const DoseEvent &ev, uint32_t lateSec) const;
+  void fire(uint8_t pump, float ml, const uint32_t *due);
+  void decide(const DoseEvent &ev, float ml);
+  void markFired(uint8_t pump, uint8_t slot, uint32_t due);
+
+  void loadState();
+  bool compactState();
 };
 
 extern Scheduler scheduler;
@@ -1,21 +1,40 @@
 #pragma once
 #include <ArduinoJson.h>
+#include "Hal.h"
 
 constexpr uint8_t NUM_PUMPS = 3;         // adjust for your build
 constexpr uint8_t MAX_TIMES_PER_DAY = 8; // up to 8 dose times per pump
+constexpr uint8_t MAX_CAL_POINTS = 6;    // flow calibration points per pump
+
+// Measured flow at one PWM duty
+struct CalPoint {
+  uint8_t duty;
+  float mlPerSec;
+};
 
 struct PumpConfig {
   float mlPerSec = 1.0f;   // calibration: flow rate
   uint8_t duty = 200;      // 0..255
   uint16_t defaultRunSec = 5; // used for manual Run button
   uint8_t dirForward = 1;  // forward polarity (0/1) in case motor wired reversed
+  // flow vs. duty, sorted by duty; empty = mlPerSec at duty, linear in duty
+  uint8_t calCount = 0;
+  CalPoint cal[MAX_CAL_POINTS] = {};
+  uint16_t riseMs = 0;     // soft start: 0 -> duty over this long (0 = hard edge)
+  uint16_t fallMs = 0;     // soft stop: duty -> 0 over this long
+  uint16_t currentMa = 500;   // supply current while running, for the power budget
+  uint8_t incompatMask = 0;   // bit k: keep incompatGapSec between this pump and pump k
   // daily schedule
   uint8_t timesCount = 0;
-  uint16_t timesSec[MAX_TIMES_PER_DAY] = {}; // seconds since midnight
+  uint32_t timesSec[MAX_TIMES_PER_DAY] = {}; // seconds since midnight
   float doseML[MAX_TIMES_PER_DAY] = {};      // ml at each time
 };
 
 
+// What the scheduler does with a dose whose time passed while the device
+// was off or the clock jumped (beyond graceSec)
+enum class CatchUpPolicy : uint8_t { Skip = 0, Late, Scaled };
+
 struct Settings {
   char wifiSsid[32]   = "PHD1 2.4";
   char wifiPass[64]   = "Andrew1Laura2";
@@ -23,11 +42,24 @@ struct Settings {
   PumpConfig pump[NUM_PUMPS];
   uint16_t tzOffsetMinutes =  -240; // EDT default, will be adjusted via TZ string anyway
   bool useDST = true;
+  uint16_t graceSec = 120; // scheduler: a dose missed by up to this long still fires
+  CatchUpPolicy catchUp = CatchUpPolicy::Skip; // ...and one missed by more than that
+  // dose sequencer
+  uint8_t maxConcurrent = 2;     // pumps dosing at the same time
+  uint16_t supplyMa = 0;         // current budget across running pumps (0 = no limit)
+  uint16_t staggerMs = 250;      // minimum time between two starts (inrush)
+  uint16_t incompatGapSec = 60;  // gap between doses of incompatible additives
 };
 
 extern Settings settings;
 
-bool settingsLoad();
-bool settingsSave();
+bool settingsLoad();               // binary images (SettingsStore), imports an old settings.json once
+bool settingsSave();               // rewrites only the sections that changed
 String settingsToJson();           // for GET /api/settings
 bool settingsFromJson(const String &body, String &err); // for POST /api/settings
+bool settingsFromJson(JsonVariantConst doc, String &err);  // already-parsed body (WebSocket "settings" command)
+// Merge patch of one pump (PATCH /api/pumps/N) into a copy of its config;
+// settingsSavePump() makes it current once that pump's section is saved
+bool pumpPatchFromJson(uint8_t idx, JsonVariantConst patch, PumpConfig &out, String &err);
+bool settingsSavePump(uint8_t idx, const PumpConfig &pc);   // false (and settings unchanged) if the write fails
+const char *catchUpName(CatchUpPolicy p);                  // "skip" / "late" / "scaled"
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include "Settings.h"
+
+// Binary settings images. Each section (the system block and every pump)
+// is its own small file: a CRC-checked header followed by id/type/count
+// tagged fields described by a compile-time schema. Fields are matched by
+// id on load, so adding, dropping or widening a field needs no converter;
+// ids are never reused. A file is written to a temp name and renamed over
+// the old one, so a power loss leaves either the old or the new image.
+namespace SettingsStore {
+  constexpr uint8_t kSystem = 0xFF;   // section id of the non-pump settings; pumps are 0..NUM_PUMPS-1
+
+  bool exists();                      // is there any image on flash yet?
+  bool load(uint8_t section);         // false if missing or damaged (the section is left untouched)
+  bool save(uint8_t section);         // skips the write when flash already holds the same image
+}
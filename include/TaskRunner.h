@@ -0,0 +1,44 @@
+#pragma once
+#include "Hal.h"
+
+// Cooperative task runner for loop(). Each subsystem registers a period
+// and a deadline (how late a run may start before it counts as missed).
+// run() executes every due task, earliest deadline first, and only sleeps
+// when nothing is due.
+
+typedef void (*TaskFn)();
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t lastUs;     // duration of the most recent run
+  uint32_t maxUs;
+  uint64_t totalUs;
+  uint32_t lateMaxMs;  // worst start delay past the due time
+  uint64_t lateTotalMs;
+  uint32_t missed;     // runs that started later than the deadline
+};
+
+struct TaskInfo {
+  const char *name;
+  uint32_t periodMs;
+  uint32_t deadlineMs;
+  TaskStats stats;
+};
+
+// Busy time of the run() passes that did work (sleep excluded)
+struct PassWindow {
+  uint32_t passes;
+  uint32_t minUs, maxUs;
+  uint64_t totalUs;
+};
+
+namespace Tasks {
+  // periodMs 0 = every pass; returns the task id, -1 if the table is full
+  int add(const char *name, TaskFn fn, uint32_t periodMs, uint32_t deadlineMs);
+  void run();                       // call from loop()
+  uint8_t count();
+  const TaskInfo &info(uint8_t id);
+  uint64_t idleUs();                // time spent sleeping in run()
+  PassWindow takePasses();          // pass times since the previous call, then restart the window
+  void resetStats();
+}
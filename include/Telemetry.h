@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+
+// Health samples in a RAM ring, taken by a main-loop task every
+// TELEMETRY_PERIOD_MS: heap, loop pass times, Wi-Fi signal and client
+// counts. Served on /api/perf?series=json|bin. Optionally every Nth
+// sample is also appended to flash so the trail survives a reset.
+#ifndef TELEMETRY_PERIOD_MS
+#define TELEMETRY_PERIOD_MS 10000
+#endif
+#ifndef TELEMETRY_SAMPLES
+#define TELEMETRY_SAMPLES 90          // 15 min at the default period
+#endif
+#ifndef TELEMETRY_FLUSH_EVERY
+#define TELEMETRY_FLUSH_EVERY 0       // append every Nth sample to /telemetry.bin (0 = RAM only)
+#endif
+#ifndef TELEMETRY_FILE_MAX
+#define TELEMETRY_FILE_MAX 32768      // then /telemetry.bin becomes /telemetry.old
+#endif
+
+struct __attribute__((packed)) TelemetrySample {
+  uint32_t uptimeS;
+  uint32_t freeBytes;
+  uint32_t maxBlock;
+  uint8_t fragPct;
+  int8_t rssi;                  // dBm, 0 = not connected
+  uint16_t passes;              // loop passes that did work during the period
+  uint16_t loopMinUs, loopAvgUs, loopMaxUs;   // their busy time (saturating)
+  uint8_t wsClients;
+  uint8_t httpOpen;             // requests being handled or still sending
+};
+static_assert(sizeof(TelemetrySample) == 24, "TelemetrySample layout changed, bump kTelemetryVersion");
+constexpr uint8_t kTelemetryVersion = 1;
+
+namespace Telemetry {
+  void sample();                               // main-loop task
+  uint32_t total();                            // samples taken since boot
+  uint16_t count();                            // samples still in the ring
+  // Sample number seq (0 = first since boot); false once it left the ring
+  bool get(uint32_t seq, TelemetrySample &out);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "Hal.h"
+
+// Scoped hot-path timers on the CPU cycle counter:
+//
+//   void Scheduler::loop() {
+//     TRACE_SCOPE("sched.loop");
+//     ...
+//
+// Each probe keeps count, min/max/sum and a log2 histogram of its
+// durations. Probes only exist in builds with -DTRACE_ENABLED=1 (see
+// platformio.ini); otherwise TRACE_SCOPE expands to nothing. Results go to
+// Serial (send 't' to dump, 'r' to reset) and to /api/trace.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0
+#endif
+#ifndef TRACE_MAX_PROBES
+#define TRACE_MAX_PROBES 16
+#endif
+
+constexpr uint8_t kTraceBuckets = 12;   // < 2, < 4, ... < 2048 us, then everything longer
+
+struct TraceProbe {
+  const char *name;
+  uint32_t count;
+  uint32_t minCycles, maxCycles;
+  uint64_t sumCycles;
+  uint32_t hist[kTraceBuckets];
+};
+
+namespace Trace {
+  void reset();                             // zero every probe, keep the names
+  void dump(Print &out);                    // one line per probe, times in us
+
+#if TRACE_ENABLED
+  uint8_t count();                          // probes hit so far
+  const TraceProbe &probe(uint8_t i);
+  void loop();                              // Serial commands ('t' dump, 'r' reset)
+
+  TraceProbe *add(const char *name);        // nullptr once the table is full
+  void record(TraceProbe *p, uint32_t cycles);
+#endif
+}
+
+#if TRACE_ENABLED
+class TraceScope {
+public:
+  explicit TraceScope(TraceProbe *p) : _p(p), _t0(hal::cycles()) {}
+  ~TraceScope() { if (_p) Trace::record(_p, hal::cycles() - _t0); }
+private:
+  TraceProbe *_p;
+  uint32_t _t0;
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+// The probe is looked up once, on the first pass through the scope
+#define TRACE_SCOPE(name)                                                       \
+  static TraceProbe *const TRACE_CAT(_traceProbe, __LINE__) = Trace::add(name); \
+  TraceScope TRACE_CAT(_traceScope, __LINE__)(TRACE_CAT(_traceProbe, __LINE__))
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
@@ -3,3 +3,5 @@
 
 void webserverBegin();
 void webserverLoop();
+uint8_t webWsClients();       // connected WebSocket clients
+uint8_t webOpenRequests();    // HTTP requests being handled or still sending
@@ -0,0 +1,167 @@
+#pragma once
+// Host side of the HAL, pulled in by Hal.h when ARDUINO is not defined
+// ([env:native]). It carries the little of the Arduino core the portable
+// modules use (String, min/max/constrain, strlcpy) and the hardware
+// stand-ins behind hal::: a fake clock that only moves when the test moves
+// it, one-shot timers fired from that clock, recorded PWM/GPIO writes and a
+// filesystem on a host directory. Implemented in src/host/HalHost.cpp.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::min;
+using std::max;
+
+template <typename T, typename L, typename H>
+inline T constrain(T v, L lo, H hi) { return (v < lo) ? T(lo) : (v > hi) ? T(hi) : v; }
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *dst, const char *src, size_t cap) {
+  size_t len = strlen(src);
+  if (cap) {
+    size_t n = (len < cap - 1) ? len : cap - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return len;
+}
+#endif
+
+// Only the parts of Arduino's String the portable code touches. write()
+// lets ArduinoJson serialize into it.
+class String {
+public:
+  String() {}
+  String(const char *s) : _s(s ? s : "") {}
+  const char *c_str() const { return _s.c_str(); }
+  size_t length() const { return _s.size(); }
+  bool reserve(size_t n) { _s.reserve(n); return true; }
+  bool concat(const char *s, size_t n) { _s.append(s, n); return true; }
+  bool endsWith(const char *s) const { size_t n = strlen(s); return _s.size() >= n && _s.compare(_s.size() - n, n, s) == 0; }
+  char operator[](size_t i) const { return i < _s.size() ? _s[i] : 0; }
+  bool operator==(const char *s) const { return _s == s; }
+  String &operator+=(const char *s) { _s += s; return *this; }
+  String &operator+=(const String &s) { _s += s._s; return *this; }
+  String &operator+=(char c) { _s += c; return *this; }
+  friend String operator+(String a, const char *b) { return a += b; }
+  friend String operator+(String a, const String &b) { return a += b; }
+  size_t write(uint8_t c) { _s += (char)c; return 1; }
+  size_t write(const uint8_t *p, size_t n) { _s.append((const char *)p, n); return n; }
+private:
+  std::string _s;
+};
+
+class Print;   // Trace::dump() target; device only
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+namespace hal {
+  // Open file under the host root. Copies share the handle, as fs::File does.
+  class File {
+  public:
+    explicit operator bool() const { return (bool)_f; }
+    size_t read(uint8_t *buf, size_t n);
+    int read();                                        // one byte, -1 at the end
+    size_t readBytes(char *buf, size_t n) { return read((uint8_t *)buf, n); }
+    size_t readBytesUntil(char term, char *buf, size_t n);
+    int available();
+    size_t write(const uint8_t *buf, size_t n);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    bool truncate(uint32_t size);
+    void flush();
+    void close() { _f.reset(); }
+  private:
+    friend class FS;
+    std::shared_ptr<FILE> _f;
+  };
+
+  class Dir {
+  public:
+    bool next() { return ++_i <= _names.size(); }
+    String fileName() const { return String(_i && _i <= _names.size() ? _names[_i - 1].c_str() : ""); }
+    size_t fileSize() const;
+    bool isDirectory() const;
+  private:
+    friend class FS;
+    std::string _path;
+    std::vector<std::string> _names;
+    size_t _i = 0;
+  };
+
+  // LittleFS calls, mapped onto host::root()
+  class FS {
+  public:
+    File open(const char *path, const char *mode);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+    Dir openDir(const char *path);
+  };
+
+  // Host counterpart of Ticker: fires from host::advanceUs() once the fake
+  // clock reaches it, between loop passes, as os_timer callbacks do.
+  class Timer {
+  public:
+    Timer();
+    ~Timer();
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    template <typename TArg>
+    void once_ms(uint32_t ms, void (*fn)(TArg), TArg arg) { arm(ms, [fn, arg] { fn(arg); }); }
+    void once_ms(uint32_t ms, std::function<void()> fn) { arm(ms, std::move(fn)); }
+    void detach() { _armed = false; }
+    bool active() const { return _armed; }
+  private:
+    friend struct TimerList;
+    void arm(uint32_t ms, std::function<void()> fn);
+    uint64_t _dueUs = 0;
+    bool _armed = false;
+    std::function<void()> _fn;
+  };
+
+  // Test controls for the stand-ins
+  namespace host {
+    struct FsStats {
+      uint32_t opens, reads, writes, seeks;
+      uint64_t bytesRead, bytesWritten;
+    };
+    typedef void (*PwmHook)(void *ctx, uint8_t ch, uint8_t duty);
+
+    void reset();                     // uptime and wall clock 0, timers disarmed, outputs low (files stay)
+    void reboot();                    // uptime 0, timers disarmed, outputs low; wall clock and files stay
+    void setTime(time_t epoch);       // wall clock, as after an NTP sync or step
+    void advanceUs(uint64_t us);      // both clocks; due timers fire in order on the way
+    inline void advanceMs(uint32_t ms) { advanceUs(ms * 1000ULL); }
+    uint64_t uptimeUs();
+    uint64_t nextTimerUs();           // until the earliest armed timer, UINT64_MAX if none
+
+    uint8_t pwm(uint8_t ch);          // last duty written to the channel
+    bool pin(uint8_t pin);            // last level written to the pin
+    uint32_t pwmWrites();
+    void onPwm(PwmHook hook, void *ctx);   // called on every pwmWrite, at uptimeUs()
+
+    void setRoot(const char *dir);    // default: a fresh directory under $TMPDIR
+    const char *root();
+    void wipeFs();                    // delete everything under the root
+    FsStats fsStats();
+    void resetFsStats();
+    void failWritesAfter(uint64_t bytes);   // flash full: writes come up short past this many more bytes (reset() lifts it)
+
+    void quiet(bool on);              // drop console output
+  }
+}
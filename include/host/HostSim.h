@@ -0,0 +1,70 @@
+#pragma once
+// Dry run of the whole dosing path on the host stand-ins ([env:native]):
+// the real Scheduler, DoseSequencer, PumpControl and Logger, booted from a
+// settings.json the way the firmware boots (legacy import into the binary
+// images), on the fake clock. Dosed volume is integrated from the PWM
+// writes through the flow model, so the sequencer's limits, ramps, stop
+// timing and doses lost to a reboot all show in the ledger. A reboot drops
+// RAM (queued jobs, running pumps) and keeps the files, as a power cycle
+// does; a stall keeps the loop tasks from running while timers still fire.
+// Implemented in src/host/HostSim.cpp; src/host/sim_main.cpp is the CLI.
+#include "Hal.h"
+#include "Settings.h"
+
+struct SimInject {
+  enum Kind : uint8_t { Reboot, Jump, Stall };
+  uint32_t at;     // epoch
+  Kind kind;
+  int32_t arg;     // reboot: seconds off, jump: clock step (+/-), stall: seconds without loop()
+};
+
+// "reboot@3600:120,jump@90000:-3600,stall@200000:900" (times from start) into
+// out[count..cap), kept sorted by time; false on a bad spec or a full array
+bool parseInjects(const char *spec, uint32_t start, SimInject *out, uint8_t cap, uint8_t &count);
+
+class HostSim {
+public:
+  static constexpr uint8_t kMaxInject = 32;
+  static constexpr float kTolMl = 0.01f;   // ledger: dosed within this of expected is "ok"
+
+  // Booked on the local day a run started
+  struct Day {
+    uint32_t startEpoch = 0;
+    float expectedMl[NUM_PUMPS] = {};
+    float dosedMl[NUM_PUMPS] = {};
+    uint16_t runs[NUM_PUMPS] = {};
+  };
+
+  // Wipe the host filesystem and boot from this settings.json (text or a
+  // host file); false if it does not parse
+  bool loadJson(const char *json);
+  bool loadFile(const char *hostPath);
+
+  // Run from local midnight of `start` for `days` days; inject as in
+  // parseInjects(). false on a bad spec.
+  bool run(uint32_t start, uint16_t days, const char *inject = nullptr);
+
+  const std::vector<Day> &days() const { return _days; }
+  uint16_t mismatched() const;
+  uint16_t reboots() const { return _reboots; }
+  // CSV ledger: one line per day and scheduled pump, then a "# ..." summary
+  void report(FILE *out) const;
+
+private:
+  std::vector<Day> _days;
+  uint32_t _end = 0;                   // epoch the last day ends at
+  SimInject _inj[kMaxInject];
+  uint8_t _injCount = 0, _injNext = 0;
+  uint16_t _reboots = 0;
+  uint8_t _duty[NUM_PUMPS] = {};       // last PWM duty per pump
+  uint64_t _dutyUs[NUM_PUMPS] = {};    // uptime it was written at
+  int32_t _runDay[NUM_PUMPS] = {};     // _days index the current run is booked on (-1 = none)
+
+  static void onPwm(void *ctx, uint8_t ch, uint8_t duty);
+  void account(uint8_t pump, uint8_t duty);
+  int32_t dayOf(uint32_t epoch) const;
+  void boot();
+  void apply(const SimInject &in);
+  bool busy() const;
+  void runUntil(uint32_t until);
+};
@@ -0,0 +1,31 @@
+# PlatformIO pre-script: store a gzip copy of every web asset in data/ so the
+# filesystem image carries <name>.gz next to the original. The web server
+# serves the .gz with Content-Encoding: gzip and uses its CRC32 trailer as
+# the ETag, so the output must be deterministic (mtime=0, fixed level).
+import gzip
+import os
+
+Import("env")  # noqa: F821  (provided by PlatformIO/SCons)
+
+EXTENSIONS = (".html", ".css", ".js", ".json", ".svg")
+
+
+def compress_assets(data_dir):
+    if not os.path.isdir(data_dir):
+        return
+    for name in sorted(os.listdir(data_dir)):
+        src = os.path.join(data_dir, name)
+        if not name.endswith(EXTENSIONS) or not os.path.isfile(src):
+            continue
+        dst = src + ".gz"
+        if os.path.exists(dst) and os.path.getmtime(dst) >= os.path.getmtime(src):
+            continue
+        with open(src, "rb") as f:
+            raw = f.read()
+        with open(dst, "wb") as out:
+            with gzip.GzipFile(filename="", mode="wb", fileobj=out, compresslevel=9, mtime=0) as gz:
+                gz.write(raw)
+        print("compress_assets: %s %d -> %d bytes" % (name, len(raw), os.path.getsize(dst)))
+
+
+compress_assets(env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
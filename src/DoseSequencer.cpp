@@ -0,0 +1,84 @@
+#include "DoseSequencer.h"
+#include "Hal.h"
+#include "PumpControl.h"
+#include "Logger.h"
+#include "Scheduler.h"
+
+DoseSequencer sequencer;
+
+void DoseSequencer::enqueue(uint8_t pump, float ml, const uint32_t *due) {
+  if (pump >= NUM_PUMPS || ml <= 0.0f) return;
+  DoseJob &j = _jobs[pump];
+  if (j.ml > 0.0f) {
+    logInfo("seq: pump %u +%.2f ml merged into waiting dose (%.2f ml)", pump, ml, j.ml + ml);
+  } else {
+    j.queuedMs = hal::millis();
+  }
+  j.ml += ml;
+  if (due)
+    for (uint8_t t = 0; t < MAX_TIMES_PER_DAY; ++t)
+      if (due[t] > j.due[t]) j.due[t] = due[t];
+}
+
+// Stamps are stored as millis() | 1 (0 = never), so one can sit a tick ahead
+// of `now`; signed differences keep that from reading as a long time ago
+static bool within(uint32_t now, uint32_t stamp, uint32_t ms) {
+  return stamp && (int32_t)(now - stamp) < (int32_t)ms;
+}
+
+bool DoseSequencer::mayStart(uint8_t pump, uint32_t now) const {
+  if (pumpCtl.isRunning(pump)) return false;                // finish the current run first
+  if (within(now, _lastStartMs, settings.staggerMs)) return false;
+
+  uint8_t running = 0;
+  uint32_t drawMa = settings.pump[pump].currentMa;
+  const uint32_t gapMs = settings.incompatGapSec * 1000UL;
+  for (uint8_t k = 0; k < NUM_PUMPS; ++k) {
+    if (k == pump) continue;
+    const PumpRuntime &s = pumpCtl.state(k);
+    bool incompat = ((settings.pump[pump].incompatMask >> k) & 1) || ((settings.pump[k].incompatMask >> pump) & 1);
+    if (incompat && (s.running || within(now, s.stopMs, gapMs))) return false;
+    if (s.running) {
+      running++;
+      drawMa += settings.pump[k].currentMa;
+    }
+  }
+  if (running >= settings.maxConcurrent) return false;
+  if (settings.supplyMa && drawMa > settings.supplyMa) return false;
+  return true;
+}
+
+// Oldest waiting job first; a blocked job does not hold back others that may run
+void DoseSequencer::loop() {
+  for (;;) {
+    const uint32_t now = hal::millis();
+    int pick = -1;
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p) {
+      if (_jobs[p].ml <= 0.0f) continue;
+      if (settings.supplyMa && settings.pump[p].currentMa > settings.supplyMa) {   // settings validation refuses this now
+        logErr("seq: pump %u draws %u mA, over the %u mA supply; %.2f ml dropped", p, settings.pump[p].currentMa,
+               settings.supplyMa, _jobs[p].ml);
+        _jobs[p] = DoseJob();
+        continue;
+      }
+      if (!mayStart(p, now)) continue;
+      if (pick < 0 || (int32_t)(_jobs[p].queuedMs - _jobs[pick].queuedMs) < 0) pick = p;
+    }
+    if (pick < 0) return;
+
+    const DoseJob j = _jobs[pick];
+    _jobs[pick] = DoseJob();
+    // The slots this dose covers count as fired once it runs. One that
+    // cannot run is dropped without that: the scheduler does not offer it
+    // again before a reboot, and after one the catch-up policy decides.
+    if (!pumpCtl.dose(pick, j.ml)) {
+      logErr("seq: pump %u cannot dose %.2f ml (no flow at duty)", pick, j.ml);
+      continue;
+    }
+    for (uint8_t t = 0; t < MAX_TIMES_PER_DAY; ++t)
+      if (j.due[t]) scheduler.commitFired(pick, t, j.due[t]);
+    if (now - j.queuedMs > 1000) logInfo("seq: pump %u started after waiting %lus", pick, (unsigned long)((now - j.queuedMs) / 1000));
+    _lastStartMs = now | 1;
+    if (settings.staggerMs) return;   // next start waits for the stagger anyway
+  }
+}
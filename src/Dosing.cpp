@@ -0,0 +1,71 @@
+#include "Dosing.h"
+#include "PwmRamp.h"
+
+float flowAt(const PumpConfig &pc, uint8_t duty) {
+  if (!pc.calCount) {
+    return pc.duty ? pc.mlPerSec * duty / pc.duty : 0.0f;
+  }
+  // Points are kept sorted by duty (settingsFromJson sorts them)
+  uint8_t d0 = 0;
+  float f0 = 0.0f;
+  for (uint8_t k = 0; k < pc.calCount; ++k) {
+    const CalPoint &c = pc.cal[k];
+    if (duty <= c.duty) {
+      if (c.duty == d0) return c.mlPerSec;
+      return f0 + (c.mlPerSec - f0) * float(duty - d0) / float(c.duty - d0);
+    }
+    d0 = c.duty;
+    f0 = c.mlPerSec;
+  }
+  return f0;   // above the last point: flat
+}
+
+// Volume of one run as PwmRamp drives it: while an edge is in progress the
+// duty is re-evaluated every RAMP_STEP_MS and held in between, so the
+// whole-duty floor of dutyAt() and the step phase are both counted
+float runMl(const PumpConfig &pc, uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs) {
+  if (riseMs + fallMs > totalMs) {   // short run: PwmRamp::start shrinks both edges the same way
+    const uint32_t sum = riseMs + fallMs;
+    riseMs = (uint64_t)riseMs * totalMs / sum;
+    fallMs = totalMs - riseMs;
+  }
+  const uint32_t fallAt = totalMs - fallMs;
+  float mlMs = 0.0f;
+  for (uint32_t t = 0; t < totalMs;) {
+    uint32_t next = (t < riseMs || t >= fallAt) ? t + RAMP_STEP_MS : fallAt;
+    if (t >= riseMs && !fallMs) next = totalMs;   // the ramp stops stepping once at the peak
+    next = min(next, totalMs);
+    mlMs += flowAt(pc, PwmRamp::dutyAt(peak, riseMs, fallMs, totalMs, t)) * (next - t);
+    t = next;
+  }
+  return mlMs / 1000.0f;
+}
+
+DosePlan planDose(const PumpConfig &pc, float ml) {
+  DosePlan p = { pc.duty, pc.riseMs, 0, pc.fallMs, flowAt(pc, pc.duty) };
+  if (ml <= 0.0f || p.flowMlps <= 0.0f) { p.riseMs = p.fallMs = 0; return p; }
+
+  const uint32_t edgesMs = p.riseMs + p.fallMs;
+  if (!edgesMs || ml >= runMl(pc, p.duty, p.riseMs, p.fallMs, edgesMs)) {
+    // Full edges: once the rise has stepped up to the peak (within one
+    // step of riseMs) every ms of hold adds the flow at duty
+    const float edgesMl = edgesMs ? runMl(pc, p.duty, p.riseMs, p.fallMs, edgesMs + RAMP_STEP_MS) -
+                                    p.flowMlps * RAMP_STEP_MS / 1000.0f : 0.0f;
+    p.holdMs = (uint32_t)max<long>(0, lroundf((ml - edgesMl) / p.flowMlps * 1000.0f));
+    return p;
+  }
+
+  // Too small for the full edges: both shrink in proportion with no hold,
+  // the run length found by bisection on the stepped volume
+  uint32_t lo = 0, hi = edgesMs;   // runMl(lo) < ml <= runMl(hi)
+  while (hi - lo > 1) {
+    const uint32_t mid = (lo + hi) / 2;
+    if (runMl(pc, p.duty, p.riseMs, p.fallMs, mid) < ml) lo = mid;
+    else hi = mid;
+  }
+  const bool loCloser = lo && ml - runMl(pc, p.duty, p.riseMs, p.fallMs, lo) < runMl(pc, p.duty, p.riseMs, p.fallMs, hi) - ml;
+  const uint32_t totalMs = loCloser ? lo : hi;
+  p.riseMs = (uint32_t)((uint64_t)p.riseMs * totalMs / edgesMs);
+  p.fallMs = totalMs - p.riseMs;
+  return p;
+}
@@ -0,0 +1,34 @@
+#include "Hal.h"
+#include <Arduino.h>
+#include <LittleFS.h>
+
+uint32_t hal::millis() { return ::millis(); }
+uint32_t hal::micros() { return ::micros(); }
+time_t hal::now() { return time(nullptr); }
+uint32_t hal::cycles() { return ESP.getCycleCount(); }
+uint32_t hal::cpuMHz() { return ESP.getCpuFreqMHz(); }
+void hal::sleepMs(uint32_t ms) { ::delay(ms); }
+void hal::yield() { ::delay(0); }
+
+void hal::pinOutput(uint8_t pin) { pinMode(pin, OUTPUT); }
+void hal::pinWrite(uint8_t pin, bool high) { digitalWrite(pin, high ? HIGH : LOW); }
+
+// ==== PWM (ESP8266 + ESP32, 0..255 duty) ====
+#ifdef ARDUINO_ARCH_ESP8266
+void hal::pwmSetup(uint8_t /*ch*/, uint8_t pin, uint32_t freqHz) {
+  analogWriteFreq(freqHz);
+  analogWriteRange(255);            // duty will be 0..255
+  pinMode(pin, OUTPUT);
+}
+void hal::pwmWrite(uint8_t /*ch*/, uint8_t pin, uint8_t duty) { analogWrite(pin, duty); }
+#else
+void hal::pwmSetup(uint8_t ch, uint8_t pin, uint32_t freqHz) {
+  ledcSetup(ch, freqHz, 8);
+  ledcAttachPin(pin, ch);
+}
+void hal::pwmWrite(uint8_t ch, uint8_t /*pin*/, uint8_t duty) { ledcWrite(ch, duty); }
+#endif
+
+void hal::console(const char *line) { Serial.println(line); }
+
+fs::FS &hal::fs() { return LittleFS; }
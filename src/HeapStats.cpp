@@ -0,0 +1,26 @@
+#include "HeapStats.h"
+
+namespace {
+  HeapInfo s_worst = { UINT32_MAX, UINT32_MAX, 0 };
+  uint32_t s_samples = 0;
+}
+
+HeapInfo HeapStats::now() {
+  return { ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation() };
+}
+
+void HeapStats::sample() {
+  const HeapInfo h = now();
+  if (h.freeBytes < s_worst.freeBytes) s_worst.freeBytes = h.freeBytes;
+  if (h.maxBlock < s_worst.maxBlock) s_worst.maxBlock = h.maxBlock;
+  if (h.fragPct > s_worst.fragPct) s_worst.fragPct = h.fragPct;
+  s_samples++;
+}
+
+HeapInfo HeapStats::worst() {
+  return s_samples ? s_worst : now();
+}
+
+uint32_t HeapStats::samples() {
+  return s_samples;
+}
@@ -0,0 +1,56 @@
+#include "JsonArena.h"
+
+// Every block is preceded by its (rounded) size so reallocate() can copy it
+namespace {
+  constexpr size_t kHdr = sizeof(uint32_t);
+  inline size_t align4(size_t n) { return (n + 3) & ~size_t(3); }
+}
+
+JsonArena::JsonArena(void *buf, size_t cap) {
+  uintptr_t p = (uintptr_t)buf;
+  size_t skip = align4(p) - p;
+  _buf = (uint8_t *)buf + skip;
+  _cap = (cap > skip) ? (cap - skip) & ~size_t(3) : 0;
+}
+
+void JsonArena::reset() {
+  _top = 0;
+  _last = kNone;
+}
+
+void *JsonArena::allocate(size_t size) {
+  const size_t n = align4(size);
+  if (n > _cap || _top + kHdr > _cap - n) return nullptr;
+  uint32_t h = (uint32_t)n;
+  memcpy(_buf + _top, &h, kHdr);
+  _last = _top;
+  _top += kHdr + n;
+  if (_top > _peak) _peak = _top;
+  return _buf + _last + kHdr;
+}
+
+void JsonArena::deallocate(void *ptr) {
+  if (ptr && _last != kNone && ptr == _buf + _last + kHdr) {
+    _top = _last;
+    _last = kNone;
+  }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+  const size_t n = align4(newSize);
+  if (_last != kNone && ptr == _buf + _last + kHdr) {   // newest block: resize in place
+    if (n > _cap - _last - kHdr) return nullptr;
+    uint32_t h = (uint32_t)n;
+    memcpy(_buf + _last, &h, kHdr);
+    _top = _last + kHdr + n;
+    if (_top > _peak) _peak = _top;
+    return ptr;
+  }
+  uint32_t old;
+  memcpy(&old, (uint8_t *)ptr - kHdr, kHdr);
+  if (n <= old) return ptr;   // shrinking an older block: it still fits where it is
+  void *p = allocate(newSize);
+  if (p) memcpy(p, ptr, old);
+  return p;
+}
@@ -0,0 +1,62 @@
+#include "JsonPool.h"
+#include "Trace.h"
+
+namespace {
+  constexpr size_t kBlock = JSON_POOL_ARENA + JSON_POOL_OUT;
+  static_assert(JSON_POOL_SLOTS <= 8, "slot mask is 8 bits");
+
+  alignas(4) uint8_t s_mem[JSON_POOL_SLOTS][kBlock];
+  uint8_t s_busy = 0;   // bit i: slot i is lent out
+  JsonPoolStats s_stats = {};
+
+  uint8_t *acquire(int8_t &slot) {
+    for (uint8_t i = 0; i < JSON_POOL_SLOTS; ++i) {
+      if (s_busy & (1u << i)) continue;
+      s_busy |= 1u << i;
+      slot = i;
+      s_stats.leases++;
+      if (++s_stats.inUse > s_stats.inUseMax) s_stats.inUseMax = s_stats.inUse;
+      return s_mem[i];
+    }
+    slot = -1;
+    s_stats.misses++;
+    return (uint8_t *)malloc(kBlock);   // nullptr: the document just reports NoMemory
+  }
+}
+
+JsonLease::JsonLease()
+  : _block(acquire(_slot)),
+    _arena(_block, _block ? JSON_POOL_ARENA : 0),
+    _doc(&_arena),
+    _out(_block ? (char *)_block + JSON_POOL_ARENA : nullptr) {}
+
+JsonLease::~JsonLease() {
+  _doc.clear();
+  if (_arena.peak() > s_stats.arenaPeak) s_stats.arenaPeak = (uint16_t)_arena.peak();
+  if (_slot >= 0) {
+    s_busy &= ~(1u << _slot);
+    s_stats.inUse--;
+  } else {
+    free(_block);
+  }
+}
+
+// Output that does not fit the slot still goes out, through a String
+size_t JsonLease::serialize() {
+  TRACE_SCOPE("json.serialize");
+  const size_t n = measureJson(_doc);
+  if (_out && n < JSON_POOL_OUT) {
+    _outLen = serializeJson(_doc, _out, JSON_POOL_OUT);
+    if (_outLen > s_stats.outPeak) s_stats.outPeak = (uint16_t)_outLen;
+  } else {
+    _spill = String();
+    serializeJson(_doc, _spill);
+    _outLen = _spill.length();
+    s_stats.spills++;
+  }
+  return _outLen;
+}
+
+JsonPoolStats JsonPool::stats() {
+  return s_stats;
+}
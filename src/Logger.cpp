@@ -1,87 +1,689 @@
 #include "Logger.h"
+#include "Hal.h"
 #include <stdarg.h>
-
-#include <LittleFS.h>
-#include <FS.h>
 #include <time.h>
-//#include "LogRoutes.h"
+#include "CsvTokenizer.h"
+#include "Trace.h"
+
+#ifndef LOG_SEG_RECORDS
+#define LOG_SEG_RECORDS 256     // records per segment file (256 * 32 B = 8 KB)
+#endif
+#ifndef LOG_MAX_SEGMENTS
+#define LOG_MAX_SEGMENTS 8      // total cap: oldest segment is deleted beyond this
+#endif
+#ifndef LOG_INDEX_EVERY
+#define LOG_INDEX_EVERY 32      // sparse index: one entry per this many records
+#endif
+#ifndef LOG_QUEUE_MAX
+#define LOG_QUEUE_MAX 32        // records buffered in RAM before new ones are dropped
+#endif
+#ifndef LOG_FLUSH_BATCH
+#define LOG_FLUSH_BATCH 8       // flush once this many records are waiting...
+#endif
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 5000       // ...or once the oldest one has waited this long
+#endif
+
 namespace {
-  const char* kLogPath = "/logs.csv";
-}
+  // The log is a chain of append-only segments /logs/000.bin .. /logs/999.bin
+  // (ids wrap mod 1000). Every segment except the newest one is full, so a
+  // record's position follows from its index alone.
+  const char* kLogDir    = "/logs";
+  const char* kLegacyLog = "/logs.bin";
+  const char* kLegacyCsv = "/logs.csv";   // text log written by older firmware, imported once
+  const char* kIndexPath = "/logs/index.idx";
+
+  // Segment header: magic, format version, record size, segment capacity
+  struct __attribute__((packed)) LogFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recSize;
+    uint32_t capacity;
+  };
+  constexpr uint32_t kLogMagic   = 0x474F4C44; // "DLOG"
+  constexpr uint16_t kLogVersion = 3;   // 3: overUs appended to LogRecord
+  constexpr uint16_t kRecSizeV2  = 28;
+  constexpr uint32_t kSegRecs    = LOG_SEG_RECORDS;
+  constexpr uint16_t kSegIds     = 1000;
+  static_assert(LOG_SEG_RECORDS % LOG_INDEX_EVERY == 0, "segment size must be a multiple of LOG_INDEX_EVERY");
+
+  // Sparse index: timestamp of every LOG_INDEX_EVERY-th record and where it
+  // lives. Kept in RAM, mirrored to kIndexPath so boot does not rescan.
+  struct __attribute__((packed)) LogIndexEntry {
+    uint32_t ts;
+    uint16_t seg;   // segment id
+    uint16_t rec;   // record number inside the segment
+  };
+  constexpr uint16_t kIdxPerSeg = LOG_SEG_RECORDS / LOG_INDEX_EVERY;
+  LogIndexEntry s_idx[LOG_MAX_SEGMENTS * kIdxPerSeg];
+  uint16_t s_idxCount = 0;
+
+  void indexDropOldestSegment();
+
+  // Segment chain state, recovered from the directory in Logger::begin()
+  uint16_t s_firstSeg = 0;  // id of the oldest segment
+  uint16_t s_segCount = 0;
+  uint32_t s_lastRecs = 0;  // records in the newest segment
+  uint32_t s_nextSeq  = 1;  // seq of the next record to be queued
+
+  // RAM write queue (FIFO), drained by Logger::flush()
+  LogRecord s_queue[LOG_QUEUE_MAX];
+  uint16_t  s_qHead = 0, s_qCount = 0;
+  uint32_t  s_qOldestMs = 0;
+  LogQueueStats s_qStats = {};
+
+  const char* const kEventNames[]  = { "Info", "Run", "Prime", "Purge", "Stop" };
+  const char* const kStatusNames[] = { "--", "setup complete" };
+
+  inline uint32_t recOffset(uint32_t rec) {
+    return sizeof(LogFileHeader) + rec * sizeof(LogRecord);
+  }
+
+  inline uint16_t segId(uint16_t k) { return (s_firstSeg + k) % kSegIds; }
+
+  void segPath(char *out, size_t cap, uint16_t id) {
+    snprintf(out, cap, "%s/%03u.bin", kLogDir, (unsigned)id);
+  }
+
+  uint32_t totalRecords() {
+    return s_segCount ? (uint32_t)(s_segCount - 1) * kSegRecs + s_lastRecs : 0;
+  }
+
+  // Rounded the way "%.2f" rounds the float: v * 100 is exact in double and
+  // rint() breaks ties to even (lroundf(v * 100.0f) differed on ~4% of values)
+  int32_t toCenti(float v) { return (int32_t)rint((double)v * 100.0); }
+
+  // hundredths -> "12.34" (same text "%.2f" produced)
+  int fmtCenti(char *out, size_t cap, int32_t v) {
+    const char *sign = (v < 0) ? "-" : "";
+    uint32_t a = (v < 0) ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+    return snprintf(out, cap, "%s%lu.%02lu", sign, (unsigned long)(a / 100), (unsigned long)(a % 100));
+  }
+
+  // microseconds -> milliseconds "1.234" (same text "%.3f" of us / 1000.0 produced)
+  int fmtMilli(char *out, size_t cap, int32_t us) {
+    const char *sign = (us < 0) ? "-" : "";
+    uint32_t a = (us < 0) ? (uint32_t)(-(int64_t)us) : (uint32_t)us;
+    return snprintf(out, cap, "%s%lu.%03lu", sign, (unsigned long)(a / 1000), (unsigned long)(a % 1000));
+  }
+
+  int fmtTs(char *out, size_t cap, uint32_t ts) {
+    time_t t = (time_t)ts;
+    struct tm tmLocal;
+    localtime_r(&t, &tmLocal);                   // uses the current TZ + DST
+    return (int)strftime(out, cap, "%Y-%m-%d %H:%M:%S", &tmLocal);
+  }
+
+  // Parse "NNN.bin" -> id, -1 if the name is not a segment
+  int parseSegName(const char *name) {
+    if (strlen(name) != 7 || strcmp(name + 3, ".bin") != 0) return -1;
+    int id = 0;
+    for (int i = 0; i < 3; ++i) {
+      char c = name[i];
+      if (c < '0' || c > '9') return -1;
+      id = id * 10 + (c - '0');
+    }
+    return id;
+  }
+
+  // Start a new, empty segment at the end of the chain; drops the oldest
+  // one first when the chain is at LOG_MAX_SEGMENTS. Deleting is a single
+  // file remove, nothing is rewritten.
+  bool rollSegment() {
+    char path[24];
+    if (s_segCount >= LOG_MAX_SEGMENTS) {
+      segPath(path, sizeof(path), s_firstSeg);
+      hal::fs().remove(path);
+      indexDropOldestSegment();
+      s_firstSeg = (s_firstSeg + 1) % kSegIds;
+      s_segCount--;
+    }
+    uint16_t id = segId(s_segCount);
+    segPath(path, sizeof(path), id);
+    hal::File f = hal::fs().open(path, "w");
+    if (!f) return false;
+    LogFileHeader h{ kLogMagic, kLogVersion, (uint16_t)sizeof(LogRecord), kSegRecs };
+    bool ok = f.write(reinterpret_cast<const uint8_t*>(&h), sizeof(h)) == sizeof(h);
+    f.close();
+    if (!ok) { hal::fs().remove(path); return false; }
+    s_segCount++;
+    s_lastRecs = 0;
+    return true;
+  }
 
+  void removeAllSegments() {
+    hal::Dir d = hal::fs().openDir(kLogDir);
+    char path[40];
+    while (d.next()) {
+      snprintf(path, sizeof(path), "%s/%s", kLogDir, d.fileName().c_str());
+      hal::fs().remove(path);
+    }
+    s_firstSeg = 0; s_segCount = 0; s_lastRecs = 0;
+    s_idxCount = 0;
+  }
+
+  // Rewrite version-2 segments (28-byte records without overUs) in the
+  // current layout. Records keep their positions, so the index stays valid.
+  void upgradeSegments() {
+    hal::Dir d = hal::fs().openDir(kLogDir);
+    char path[40], tmp[40];
+    snprintf(tmp, sizeof(tmp), "%s/upgrade.tmp", kLogDir);
+    uint16_t upgraded = 0;
+    while (d.next()) {
+      if (parseSegName(d.fileName().c_str()) < 0) continue;
+      snprintf(path, sizeof(path), "%s/%s", kLogDir, d.fileName().c_str());
+      hal::File in = hal::fs().open(path, "r");
+      if (!in) continue;
+      LogFileHeader h{};
+      if (in.read(reinterpret_cast<uint8_t*>(&h), sizeof(h)) != sizeof(h) ||
+          h.magic != kLogMagic || h.version != 2 || h.recSize != kRecSizeV2) { in.close(); continue; }
+      hal::File out = hal::fs().open(tmp, "w");
+      if (!out) { in.close(); break; }
+      h.version = kLogVersion;
+      h.recSize = sizeof(LogRecord);
+      bool ok = out.write(reinterpret_cast<const uint8_t*>(&h), sizeof(h)) == sizeof(h);
+      LogRecord r;
+      while (ok && in.read(reinterpret_cast<uint8_t*>(&r), kRecSizeV2) == kRecSizeV2) {
+        r.overUs = 0;
+        ok = out.write(reinterpret_cast<const uint8_t*>(&r), sizeof(r)) == sizeof(r);
+      }
+      in.close();
+      out.close();
+      if (!ok) { hal::fs().remove(tmp); break; }
+      hal::fs().remove(path);
+      hal::fs().rename(tmp, path);
+      upgraded++;
+      hal::yield();
+    }
+    if (upgraded) logInfo("log: upgraded %u segment(s) to format %u", upgraded, kLogVersion);
+  }
+
+  // Rebuild the chain state from the directory listing. The ids present
+  // form one contiguous run (mod 1000); its start is the id whose
+  // predecessor is missing.
+  bool recoverSegments() {
+    uint32_t present[(kSegIds + 31) / 32] = {};
+    uint16_t found = 0;
+    hal::Dir d = hal::fs().openDir(kLogDir);
+    while (d.next()) {
+      int id = parseSegName(d.fileName().c_str());
+      if (id < 0) continue;
+      present[id >> 5] |= 1UL << (id & 31);
+      found++;
+    }
+    s_firstSeg = 0; s_segCount = 0; s_lastRecs = 0;
+    if (!found) return true;
+
+    auto has = [&](int id) { id = (id + kSegIds) % kSegIds; return (present[id >> 5] >> (id & 31)) & 1; };
+    int start = -1;
+    for (int id = 0; id < kSegIds && start < 0; ++id) if (has(id) && !has(id - 1)) start = id;
+    if (start < 0) return false;   // all 1000 ids present: not a chain we wrote
+
+    s_firstSeg = (uint16_t)start;
+    while (s_segCount < found && has(start + s_segCount)) s_segCount++;
+    if (s_segCount != found) logWarn("log: %u stray segment(s) ignored", (unsigned)(found - s_segCount));
+    while (s_segCount > LOG_MAX_SEGMENTS) {      // cap was lowered since last boot
+      char path[24];
+      segPath(path, sizeof(path), s_firstSeg);
+      hal::fs().remove(path);
+      s_firstSeg = (s_firstSeg + 1) % kSegIds;
+      s_segCount--;
+    }
+
+    // Newest segment: check the header, drop a torn trailing record
+    char path[24];
+    segPath(path, sizeof(path), segId(s_segCount - 1));
+    hal::File f = hal::fs().open(path, "r+");
+    if (!f) return false;
+    LogFileHeader h{};
+    if (f.read(reinterpret_cast<uint8_t*>(&h), sizeof(h)) != sizeof(h) ||
+        h.magic != kLogMagic || h.version != kLogVersion ||
+        h.recSize != sizeof(LogRecord) || h.capacity != kSegRecs) {
+      f.close();
+      return false;
+    }
+    size_t body = f.size() - sizeof(h);
+    s_lastRecs = min<uint32_t>(body / sizeof(LogRecord), kSegRecs);
+    if (body % sizeof(LogRecord)) f.truncate(recOffset(s_lastRecs));
+    if (s_lastRecs) {
+      LogRecord r;
+      f.seek(recOffset(s_lastRecs - 1), SeekSet);
+      if (f.read(reinterpret_cast<uint8_t*>(&r), sizeof(r)) == sizeof(r)) s_nextSeq = r.seq + 1;
+    }
+    f.close();
+    return true;
+  }
+
+  // ---- sparse index ----
+
+  bool indexSave() {
+    hal::File f = hal::fs().open(kIndexPath, "w");
+    if (!f) return false;
+    size_t bytes = s_idxCount * sizeof(LogIndexEntry);
+    bool ok = f.write(reinterpret_cast<const uint8_t*>(s_idx), bytes) == bytes;
+    f.close();
+    return ok;
+  }
+
+  // Called before the oldest segment is deleted: its entries are always
+  // the first kIdxPerSeg ones.
+  void indexDropOldestSegment() {
+    uint16_t n = min<uint16_t>(s_idxCount, kIdxPerSeg);
+    memmove(s_idx, s_idx + n, (s_idxCount - n) * sizeof(LogIndexEntry));
+    s_idxCount -= n;
+    indexSave();
+  }
+
+  // Entry j always describes logical record j * LOG_INDEX_EVERY
+  uint16_t indexExpected() {
+    uint32_t n = totalRecords();
+    return (uint16_t)((n + LOG_INDEX_EVERY - 1) / LOG_INDEX_EVERY);
+  }
+
+  void indexPosition(uint16_t j, uint16_t &seg, uint16_t &rec) {
+    uint32_t i = (uint32_t)j * LOG_INDEX_EVERY;
+    seg = segId(i / kSegRecs);
+    rec = i % kSegRecs;
+  }
+
+  bool indexLoad() {
+    hal::File f = hal::fs().open(kIndexPath, "r");
+    if (!f) return false;
+    size_t n = f.size() / sizeof(LogIndexEntry);
+    if (n > sizeof(s_idx) / sizeof(s_idx[0])) { f.close(); return false; }
+    s_idxCount = f.read(reinterpret_cast<uint8_t*>(s_idx), n * sizeof(LogIndexEntry)) / sizeof(LogIndexEntry);
+    f.close();
+    return s_idxCount == n;
+  }
+
+  // Stale if an entry points somewhere it should not, or the newest entry's
+  // timestamp no longer matches the record it describes.
+  bool indexValid() {
+    if (s_idxCount != indexExpected()) return false;
+    for (uint16_t j = 0; j < s_idxCount; ++j) {
+      uint16_t seg, rec;
+      indexPosition(j, seg, rec);
+      if (s_idx[j].seg != seg || s_idx[j].rec != rec) return false;
+    }
+    if (!s_idxCount) return true;
+    LogReader rd;
+    LogRecord r;
+    bool ok = rd.open() && rd.read((uint32_t)(s_idxCount - 1) * LOG_INDEX_EVERY, r) && r.ts == s_idx[s_idxCount - 1].ts;
+    rd.close();
+    return ok;
+  }
+
+  void indexRebuild() {
+    LogReader rd;
+    LogRecord r;
+    s_idxCount = 0;
+    if (rd.open()) {
+      uint16_t want = indexExpected();
+      for (uint16_t j = 0; j < want; ++j) {
+        if (!rd.read((uint32_t)j * LOG_INDEX_EVERY, r)) break;
+        uint16_t seg, rec;
+        indexPosition(j, seg, rec);
+        s_idx[j] = { r.ts, seg, rec };
+        s_idxCount++;
+      }
+      rd.close();
+    }
+    indexSave();
+  }
+
+  // Append entries for records [from, from + n) of the newest segment
+  // (positions relative to that segment) that land on an index boundary.
+  void indexNoteWritten(const LogRecord *recs, uint32_t from, uint32_t n, hal::File &idxFile) {
+    uint32_t first = (from + LOG_INDEX_EVERY - 1) / LOG_INDEX_EVERY * LOG_INDEX_EVERY;
+    for (uint32_t p = first; p < from + n; p += LOG_INDEX_EVERY) {
+      if (s_idxCount >= sizeof(s_idx) / sizeof(s_idx[0])) return;
+      LogIndexEntry &e = s_idx[s_idxCount++];
+      e.ts  = recs[p - from].ts;
+      e.seg = segId(s_segCount - 1);
+      e.rec = (uint16_t)p;
+      if (!idxFile) idxFile = hal::fs().open(kIndexPath, "a");
+      if (idxFile) idxFile.write(reinterpret_cast<const uint8_t*>(&e), sizeof(e));
+    }
+  }
 
+  // ---- legacy CSV import ----
 
-  void ensureHeader() {
-    if (LittleFS.exists(kLogPath)) return;
-    File f = LittleFS.open(kLogPath, "w");
+  int nameCode(const CsvField &f, const char* const *names, size_t count) {
+    for (size_t i = 0; i < count; ++i) if (csvEquals(f, names[i])) return (int)i;
+    return -1;
+  }
+
+  // "YYYY-MM-DD HH:MM:SS" (local time) -> epoch
+  uint32_t parseTs(const CsvField &f) {
+    char buf[20];
+    size_t n = min<size_t>(f.len, sizeof(buf) - 1);
+    memcpy(buf, f.p, n); buf[n] = 0;
+    struct tm t{};
+    if (sscanf(buf, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) return 0;
+    t.tm_year -= 1900; t.tm_mon -= 1; t.tm_isdst = -1;
+    time_t e = mktime(&t);
+    return (e > 0) ? (uint32_t)e : 0;
+  }
+
+  // Convert the old text log into records, one fixed line buffer and
+  // field views into it; no per-row allocation. Columns are found by
+  // header name, as the old CSV->JSON route did.
+  void importLegacyCsv() {
+    hal::File f = hal::fs().open(kLegacyCsv, "r");
     if (!f) return;
-    f.println(F("ts,uptime_ms,event,pump,runtime,mlps,ml,duty,dir,status"));
+    char line[160];
+    CsvField fld[12];
+    size_t len = csvRstrip(line, f.readBytesUntil('\n', line, sizeof(line)));
+    char delim = csvDetectDelim(line, len);
+    size_t nf = csvSplit(line, len, delim, fld, 12);
+
+    enum { TS, UPTIME, EVENT, PUMP, RUNTIME, MLPS, ML, DUTY, DIR, STATUS, NCOLS };
+    static const char* const kCols[NCOLS] = { "ts", "uptime_ms", "event", "pump", "runtime", "mlps", "ml", "duty", "dir", "status" };
+    int col[NCOLS];
+    for (int c = 0; c < NCOLS; ++c) col[c] = -1;
+    for (size_t i = 0; i < nf; ++i) {
+      for (int c = 0; c < NCOLS; ++c) {
+        if (col[c] < 0 && csvStartsWith(fld[i], kCols[c])) { col[c] = (int)i; break; }
+      }
+    }
+
+    uint32_t rows = 0, unknown = 0;
+    static const CsvField kEmpty = { "", 0 };
+    while (f.available()) {
+      len = csvRstrip(line, f.readBytesUntil('\n', line, sizeof(line)));
+      if (!len) continue;
+      nf = csvSplit(line, len, delim, fld, 12);
+      auto get = [&](int c) -> const CsvField& { return (col[c] >= 0 && (size_t)col[c] < nf) ? fld[col[c]] : kEmpty; };
+
+      int ev = nameCode(get(EVENT), kEventNames, sizeof(kEventNames) / sizeof(kEventNames[0]));
+      int st = nameCode(get(STATUS), kStatusNames, sizeof(kStatusNames) / sizeof(kStatusNames[0]));
+      if (ev < 0 || st < 0) unknown++;
+
+      if (s_qCount >= LOG_QUEUE_MAX) Logger::flush();
+      if (s_qCount >= LOG_QUEUE_MAX) break;   // flash write failing, give up
+      LogRecord &r = s_queue[(s_qHead + s_qCount++) % LOG_QUEUE_MAX];
+      r.seq      = s_nextSeq++;
+      r.ts       = parseTs(get(TS));
+      r.uptimeMs = (uint32_t)csvToLong(get(UPTIME));
+      r.runtimeC = csvToCenti(get(RUNTIME));
+      r.mlC      = csvToCenti(get(ML));
+      r.mlpsC    = (uint16_t)constrain(csvToCenti(get(MLPS)), 0, 65535);
+      r.pump     = (int16_t)csvToLong(get(PUMP));
+      r.duty     = (uint8_t)constrain(csvToLong(get(DUTY)), 0, 255);
+      r.dir      = (int8_t)csvToLong(get(DIR));
+      r.event    = (uint8_t)(ev < 0 ? (int)LogEvent::Info : ev);
+      r.status   = (uint8_t)(st < 0 ? (int)LogStatus::None : st);
+      r.overUs   = 0;
+      rows++;
+      if ((rows & 0x3F) == 0) hal::yield();
+    }
     f.close();
+    Logger::flush();
+    hal::fs().remove(kLegacyCsv);
+    logInfo("log: imported %lu rows from %s (%lu with unknown event/status)",
+            (unsigned long)rows, kLegacyCsv, (unsigned long)unknown);
   }
-  
+}
 
 
 // FS must already be mounted elsewhere
-void Logger::begin() { ensureHeader(); }
+void Logger::begin() {
+  if (hal::fs().exists(kLegacyLog)) hal::fs().remove(kLegacyLog);   // single-file ring from older firmware
+  if (!hal::fs().exists(kLogDir)) hal::fs().mkdir(kLogDir);
+  upgradeSegments();
+  if (!recoverSegments()) {
+    logWarn("log: segment chain unreadable, starting a new log");
+    removeAllSegments();
+  }
+  if (!indexLoad() || !indexValid()) {
+    logInfo("log: rebuilding index");
+    indexRebuild();
+  }
+  if (hal::fs().exists(kLegacyCsv)) importLegacyCsv();
+}
 
 bool Logger::clear() {
-  LittleFS.remove(kLogPath);
-  ensureHeader();
+  s_qHead = s_qCount = 0;
+  removeAllSegments();
+  indexSave();
+  return rollSegment();
+}
+
+bool Logger::exists() { return s_segCount > 0; }
+
+// Index of the oldest of the newest n records matching q, found by
+// walking backwards from the end (returns rd.size() if nothing matches).
+uint32_t Logger::tailStart(LogReader &rd, size_t n, const LogQuery &q) {
+  uint32_t start = rd.size();
+  size_t found = 0;
+  LogRecord r;
+  for (uint32_t i = rd.size(); i-- > 0 && found < n; ) {
+    if (!rd.readBack(i, r)) break;
+    if (r.ts < q.from) break;
+    if (!q.matches(r)) continue;
+    start = i;
+    found++;
+    if ((found & 0x3F) == 0) hal::yield();
+  }
+  return start;
+}
+
+// Binary search over the sparse index. Timestamps are assumed to be
+// non-decreasing; after a backwards clock step the result is only a hint.
+uint32_t Logger::seekTime(uint32_t from) {
+  uint16_t lo = 0, hi = s_idxCount;   // find the first entry with ts >= from
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (s_idx[mid].ts < from) lo = mid + 1; else hi = mid;
+  }
+  return lo ? (uint32_t)(lo - 1) * LOG_INDEX_EVERY : 0;
+}
+
+void Logger::logEvent(LogEvent event, int pump, float runtime, float mlps, float ml, int duty, int direction, LogStatus status, int32_t overUs) {
+  TRACE_SCOPE("log.event");
+  if (s_qCount >= LOG_QUEUE_MAX) { s_qStats.dropped++; return; }
+
+  LogRecord &r = s_queue[(s_qHead + s_qCount) % LOG_QUEUE_MAX];
+  r.seq      = s_nextSeq++;
+  r.ts       = (uint32_t)hal::now();
+  r.uptimeMs = hal::millis();
+  r.runtimeC = toCenti(runtime);
+  r.mlC      = toCenti(ml);
+  r.mlpsC    = (uint16_t)constrain(toCenti(mlps), 0, 65535);
+  r.pump     = (int16_t)pump;
+  r.duty     = (uint8_t)constrain(duty, 0, 255);
+  r.dir      = (int8_t)direction;
+  r.event    = (uint8_t)event;
+  r.status   = (uint8_t)status;
+  r.overUs   = overUs;
+
+  if (s_qCount++ == 0) s_qOldestMs = hal::millis();
+}
+
+// While pumps are running (idle == false) only flush when the queue is
+// nearly full, so flash writes stay out of the way of the stop edges.
+void Logger::loop(bool idle) {
+  if (!s_qCount) return;
+  bool due = (s_qCount >= LOG_FLUSH_BATCH) || (hal::millis() - s_qOldestMs >= LOG_FLUSH_MS);
+  if (!idle) due = (s_qCount >= LOG_QUEUE_MAX * 3 / 4);
+  if (due) flush();
+}
+
+// One open/append/close per segment touched, normally one per batch.
+// When the newest segment fills up the chain rolls over to a fresh one.
+// A short write (flash full) can leave part of a record at the end of the
+// segment; it is cut back to the last whole record before anything else is
+// appended, so later records stay aligned with their index.
+void Logger::flush() {
+  if (!s_qCount) return;
+  uint32_t t0 = hal::micros();
+  char path[24];
+  hal::File idxFile;   // opened only when a batch crosses an index boundary
+
+  while (s_qCount) {
+    if (s_segCount == 0 || s_lastRecs >= kSegRecs) {
+      if (idxFile) idxFile.close();   // rolling may rewrite the index file
+      if (!rollSegment()) break;   // keep the queue, retry on the next flush
+    }
+    segPath(path, sizeof(path), segId(s_segCount - 1));
+    hal::File f = hal::fs().open(path, "a");
+    if (!f) break;
+    if (f.size() != recOffset(s_lastRecs) && !f.truncate(recOffset(s_lastRecs))) {
+      logErr("log: cannot trim %s to %lu records", path, (unsigned long)s_lastRecs);
+      f.close();
+      break;
+    }
+    while (s_qCount && s_lastRecs < kSegRecs) {
+      uint32_t run = min<uint32_t>(s_qCount, LOG_QUEUE_MAX - s_qHead);   // contiguous in the queue
+      run = min<uint32_t>(run, kSegRecs - s_lastRecs);                   // room left in the segment
+      size_t bytes = run * sizeof(LogRecord);
+      if (f.write(reinterpret_cast<const uint8_t*>(&s_queue[s_qHead]), bytes) != bytes) {
+        f.truncate(recOffset(s_lastRecs));   // checked again on the next flush
+        break;
+      }
+      indexNoteWritten(&s_queue[s_qHead], s_lastRecs, run, idxFile);
+      s_qHead     = (s_qHead + run) % LOG_QUEUE_MAX;
+      s_qCount   -= run;
+      s_lastRecs += run;
+    }
+    f.close();
+    if (s_qCount && s_lastRecs < kSegRecs) break;   // short write
+  }
+  if (idxFile) idxFile.close();
+  if (s_qCount) s_qOldestMs = hal::millis();   // retry after another LOG_FLUSH_MS
+
+  s_qStats.flushes++;
+  s_qStats.lastFlushUs = hal::micros() - t0;
+  if (s_qStats.lastFlushUs > s_qStats.maxFlushUs) s_qStats.maxFlushUs = s_qStats.lastFlushUs;
+}
+
+uint32_t Logger::nextSeq() { return s_nextSeq; }
+
+bool Logger::queued(uint32_t seq, LogRecord &out) {
+  const uint32_t k = seq - (s_nextSeq - s_qCount);   // position from the head; wraps high when flushed
+  if (k >= s_qCount) return false;
+  out = s_queue[(s_qHead + k) % LOG_QUEUE_MAX];
   return true;
 }
 
-bool Logger::exists() { return LittleFS.exists(kLogPath); }
+LogQueueStats Logger::queueStats() {
+  LogQueueStats st = s_qStats;
+  st.depth = s_qCount;
+  return st;
+}
+
+const char* Logger::csvHeader() { return "ts,uptime_ms,event,pump,runtime,mlps,ml,duty,dir,status,overshoot_ms\n"; }
+
+const char* Logger::eventName(uint8_t code) {
+  return (code < sizeof(kEventNames) / sizeof(kEventNames[0])) ? kEventNames[code] : "?";
+}
 
-// Efficient tail N lines
-String Logger::tail(size_t maxLines) {
-  File f = LittleFS.open(kLogPath, "r");
-  if (!f) return String();
-  int64_t pos = (int64_t)f.size() - 1;
-  size_t lines = 0, spins =0 ;
-  while (pos >= 0 && lines <= maxLines) {
-    f.seek(pos, SeekSet);
-    int c = f.read();
-    if (c == '\n') { lines++; if (lines > maxLines) { pos++; break; } }
-    pos--;
-     if ((++spins & 0x3FFF) == 0) delay(0);  // yield every ~16k iterations
+const char* Logger::statusName(uint8_t code) {
+  return (code < sizeof(kStatusNames) / sizeof(kStatusNames[0])) ? kStatusNames[code] : "?";
+}
+
+int Logger::eventCode(const char* name) {
+  for (size_t i = 0; i < sizeof(kEventNames) / sizeof(kEventNames[0]); ++i) {
+    if (strcasecmp(name, kEventNames[i]) == 0) return (int)i;
   }
-  if (pos < 0) pos = 0;
-  f.seek(pos, SeekSet);
-  String out; out.reserve(4096);
-  while (f.available()) {
-    out += char(f.read());
-    if ((++spins & 0x7FF) == 0) delay(0);
-  }  
-  f.close();
-  return out;
+  return -1;
+}
+
+size_t Logger::formatCsv(const LogRecord &r, char *out, size_t cap) {
+  char ts[20], run[16], mlps[16], ml[16], over[16];
+  fmtTs(ts, sizeof(ts), r.ts);
+  fmtCenti(run, sizeof(run), r.runtimeC);
+  fmtCenti(mlps, sizeof(mlps), r.mlpsC);
+  fmtCenti(ml, sizeof(ml), r.mlC);
+  fmtMilli(over, sizeof(over), r.overUs);
+  int n = snprintf(out, cap, "%s,%lu,%s,%d,%s,%s,%s,%u,%d,%s,%s\n",
+                   ts, (unsigned long)r.uptimeMs, eventName(r.event), r.pump,
+                   run, mlps, ml, r.duty, r.dir, statusName(r.status), over);
+  return (n > 0 && (size_t)n < cap) ? (size_t)n : 0;
 }
 
-void Logger::logEvent(const char* event, int pump, float runtime, float mlps,float ml, int duty, int direction, const char* status) {
-  ensureHeader();
-  File f = LittleFS.open(kLogPath, "a");
-  if (!f) return;
- // const unsigned long ts = time(nullptr);
-  const unsigned long up = millis();
+// Event and status names are fixed ASCII, so no JSON escaping is needed.
+size_t Logger::formatJson(const LogRecord &r, char *out, size_t cap) {
+  char ts[20], run[16], mlps[16], ml[16], over[16];
+  fmtTs(ts, sizeof(ts), r.ts);
+  fmtCenti(run, sizeof(run), r.runtimeC);
+  fmtCenti(mlps, sizeof(mlps), r.mlpsC);
+  fmtCenti(ml, sizeof(ml), r.mlC);
+  fmtMilli(over, sizeof(over), r.overUs);
+  int n = snprintf(out, cap,
+                   "{\"ts\":\"%s\",\"uptime_ms\":%lu,\"event\":\"%s\",\"pump\":%d,\"runtime\":%s,"
+                   "\"mlps\":%s,\"ml\":%s,\"duty\":%u,\"dir\":%d,\"status\":\"%s\",\"overshoot_ms\":%s}",
+                   ts, (unsigned long)r.uptimeMs, eventName(r.event), r.pump,
+                   run, mlps, ml, r.duty, r.dir, statusName(r.status), over);
+  return (n > 0 && (size_t)n < cap) ? (size_t)n : 0;
+}
+
+
+// ---- LogReader ----
+
+bool LogReader::open() {
+  _count    = totalRecords();
+  _firstSeg = s_firstSeg;
+  _seg      = -1;
+  _bufLen   = 0;
+  return s_segCount > 0;
+}
+
+void LogReader::close() {
+  if (_f) _f.close();
+  _seg = -1;
+  _bufLen = 0;
+}
 
-  time_t now = time(nullptr);
-  struct tm tmLocal;
-  localtime_r(&now, &tmLocal);                 // uses your TZ + DST
-  char tsbuf[20];                               // "YYYY-MM-DD HH:MM:SS" = 19 + NUL
-  strftime(tsbuf, sizeof(tsbuf), "%Y-%m-%d %H:%M:%S", &tmLocal);
+// Load up to kBufRecs consecutive records of one segment, starting at first.
+bool LogReader::fill(uint32_t first) {
+  int32_t seg = (int32_t)(first / kSegRecs);
+  uint32_t rec = first % kSegRecs;
+  if (seg != _seg) {
+    if (_f) _f.close();
+    char path[24];
+    segPath(path, sizeof(path), (_firstSeg + seg) % kSegIds);
+    _f = hal::fs().open(path, "r");
+    if (!_f) { _seg = -1; return false; }
+    _seg = seg;
+  }
+  uint32_t want = min<uint32_t>(kBufRecs, kSegRecs - rec);
+  want = min<uint32_t>(want, _count - first);
+  if (!_f.seek(recOffset(rec), SeekSet)) return false;
+  size_t got = _f.read(reinterpret_cast<uint8_t*>(_buf), want * sizeof(LogRecord)) / sizeof(LogRecord);
+  if (!got) return false;
+  _bufIdx = first;
+  _bufLen = (uint8_t)got;
+  return true;
+}
 
-  f.printf("%s,%lu,%s,%d,%.2f,%.2f,%.2f,%d,%d,%s\n",
-           tsbuf, up, event, pump,  runtime, mlps, ml, duty, direction,status);
-  f.close();
+bool LogReader::read(uint32_t i, LogRecord &out) {
+  if (i >= _count) return false;
+  if ((_bufLen == 0 || i < _bufIdx || i >= _bufIdx + _bufLen) && !fill(i)) return false;
+  out = _buf[i - _bufIdx];
+  return true;
 }
 
+// Same as read(), but a miss loads the block that ends at i, so a
+// newest-first walk costs one seek+read per block instead of per record.
+bool LogReader::readBack(uint32_t i, LogRecord &out) {
+  if (i >= _count) return false;
+  if (_bufLen == 0 || i < _bufIdx || i >= _bufIdx + _bufLen) {
+    uint32_t back = min<uint32_t>(kBufRecs - 1, i % kSegRecs);   // stay inside the segment
+    if (!fill(i - back)) return false;
+  }
+  out = _buf[i - _bufIdx];
+  return true;
+}
 
 
-static void vlogWith(const __FlashStringHelper *tag, const char *fmt, va_list ap) {
+static void vlogWith(const char *tag, const char *fmt, va_list ap) {
   char buf[256];
-  vsnprintf(buf, sizeof(buf), fmt, ap);
-  Serial.printf("[%s] %s\n", reinterpret_cast<const char *>(tag), buf);
+  int n = snprintf(buf, sizeof(buf), "[%s] ", tag);
+  vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
+  hal::console(buf);
 }
 
-void logInfo(const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith(F("INFO"), fmt, ap); va_end(ap); }
-void logWarn(const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith(F("WARN"), fmt, ap); va_end(ap); }
-void logErr (const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith(F("ERR"),  fmt, ap); va_end(ap); }
+void logInfo(const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith("INFO", fmt, ap); va_end(ap); }
+void logWarn(const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith("WARN", fmt, ap); va_end(ap); }
+void logErr (const char *fmt, ...) { va_list ap; va_start(ap, fmt); vlogWith("ERR",  fmt, ap); va_end(ap); }
@@ -1,8 +1,9 @@
 #include "PumpControl.h"
 #include "Settings.h"
-#include <Arduino.h>
 #include "Logger.h"
-#include <LittleFS.h>
+#include "Dosing.h"
+#include "PwmRamp.h"
+#include "Hal.h"
 // Make sure NUM_PUMPS is visible here (it should come from a shared header)
 #ifndef NUM_PUMPS
 #define NUM_PUMPS 3   // <-- replace with your real value if needed
@@ -10,140 +11,215 @@
 
 
 
-// ==== PWM SHIM (ESP8266 + ESP32, 0..255 duty) ====
-#ifdef ARDUINO_ARCH_ESP8266
-  inline void pwmSetup(uint8_t /*ch*/, uint16_t freqHz = 20000, uint16_t range = 255) {
-    analogWriteFreq(freqHz);
-    analogWriteRange(range);            // duty will be 0..255
-  }
-  inline void pwmAttachPin(uint8_t pin, uint8_t /*ch*/) { pinMode(pin, OUTPUT); }
-  inline void pwmWrite(uint8_t /*ch*/, uint16_t duty, uint8_t pin) { analogWrite(pin, duty); 
-
-  Serial.print(pin);
-   Serial.print("   ");
-    Serial.println(duty);
-   }
-
-#else
-  inline void pwmSetup(uint8_t ch, uint32_t freqHz = 20000, uint8_t bits = 8) { ledcSetup(ch, freqHz, bits); }
-  inline void pwmAttachPin(uint8_t pin, uint8_t ch) { ledcAttachPin(pin, ch); }
-  inline void pwmWrite(uint8_t ch, uint32_t duty, uint8_t /*pin*/) { ledcWrite(ch, duty); }
-#endif
-
 // One-time init flags for PWM channels (file-scope, visible to both functions)
 static bool s_pwmInited[NUM_PUMPS] = {};   // zero-initialized
 
-const char* R = "Run";
-const char* P = "Prime";
-const char* G = "Purge";
-const char* S = "Stop";
+// Stop edges are armed as one-shot timers when a pump starts. On the ESP8266
+// these are os_timer callbacks run by the SYS task: they never preempt
+// loop(), they fire at the first yield point (end of a loop() pass,
+// delay(), yield()) after the due time. The cut is therefore as late as the
+// longest stretch without a yield, not as late as the next pump task run;
+// long loop work has to yield. The callback only cuts the output and
+// stamps the time; logging and state updates wait for loop().
+static hal::Timer s_stopTimer[NUM_PUMPS];
+
+#ifndef PUMP_STOP_SLACK_MS
+#define PUMP_STOP_SLACK_MS 20   // loop() stops the pump itself if the timer is this late
+#endif
+
+static void onStopTimer(uint8_t idx) { pumpCtl.cutFromTimer(idx); }
 
+// Soft start/stop for every run (manual and scheduled)
+static PwmRamp s_ramp;
+static void onRampDuty(uint8_t idx, uint8_t duty, uint32_t nowUs) { pumpCtl.applyDuty(idx, duty, nowUs); }
 
 PumpControl pumpCtl;
 
 void PumpControl::begin(const PumpPins pins[NUM_PUMPS]) {
   for (int i = 0; i < NUM_PUMPS; ++i) {
     _pins[i] = pins[i];
-    pinMode(_pins[i].pwm, OUTPUT);
-    pinMode(_pins[i].dir, OUTPUT);
+    hal::pinOutput(_pins[i].pwm);
+    hal::pinOutput(_pins[i].dir);
     writePump(i, false, false);
   }
+  s_ramp.begin(onRampDuty);
 }
 
 void PumpControl::writePump(uint8_t idx, bool on, bool reverse) {
+  writeDuty(idx, on ? settings.pump[idx].duty : 0, reverse);
+}
+
+void PumpControl::writeDuty(uint8_t idx, uint8_t duty, bool reverse) {
   if (idx >= NUM_PUMPS) return;
 
   // One-time PWM init for this channel/pin
   if (!s_pwmInited[idx]) {
-    pinMode(_pins[idx].dir, OUTPUT);
-    pwmSetup(idx, 20000 /*Hz*/, 255 /*8-bit duty range*/);
-    pwmAttachPin(_pins[idx].pwm, idx);
+    hal::pinOutput(_pins[idx].dir);
+    hal::pwmSetup(idx, _pins[idx].pwm, 20000 /*Hz*/);
     s_pwmInited[idx] = true;
   }
 
-  // Duty (clamped 0..255)
-  uint16_t duty = on ? settings.pump[idx].duty : 0;
-  if (duty > 255) duty = 255;
-
   // Direction logic (same as your original)
   const bool forwardPol = settings.pump[idx].dirForward;
   const bool dirLevel   = reverse ? !forwardPol : forwardPol;
-  digitalWrite(_pins[idx].dir, dirLevel ? HIGH : LOW);
+  hal::pinWrite(_pins[idx].dir, dirLevel);
 
-  // Write PWM (shim maps to analogWrite on ESP8266, ledcWrite on ESP32)
-  pwmWrite(idx, duty, _pins[idx].pwm);
+  // Write PWM (analogWrite on ESP8266, ledcWrite on ESP32)
+  hal::pwmWrite(idx, _pins[idx].pwm, duty);
 }
 
-void PumpControl::startPump(uint8_t idx, bool reverse, uint16_t seconds) {
+void PumpControl::startPump(uint8_t idx, bool reverse, uint32_t durMs, uint8_t duty, uint32_t riseMs, uint32_t fallMs) {
   if (idx >= NUM_PUMPS) return;
-  if (seconds == 0)     return;
+  if (durMs == 0)       return;
 
   // One-time PWM setup/attach for this channel/pin
   if (!s_pwmInited[idx]) {
-    pinMode(_pins[idx].dir, OUTPUT);
-    pwmSetup(idx, 20000 /*Hz*/, 255 /*8-bit duty range*/);
-    pwmAttachPin(_pins[idx].pwm, idx);
+    hal::pinOutput(_pins[idx].dir);
+    hal::pwmSetup(idx, _pins[idx].pwm, 20000 /*Hz*/);
     s_pwmInited[idx] = true;
   }
 
+  // A manual command on a running pump replaces the run; close the old one
+  // first so its volume is logged
+  if (_state[idx].running) stop(idx);
+
   // Update runtime state (same as your original)
+  s_stopTimer[idx].detach();
   _state[idx].running      = true;
   _state[idx].reverse      = reverse;
-  _state[idx].startMs      = millis();
-  _state[idx].durMs        = (uint32_t)seconds * 1000UL;
+  _state[idx].startMs      = hal::millis();
+  _state[idx].durMs        = durMs;
   _state[idx].deliveredML  = 0.0f;
+  _state[idx].cutPending   = false;
+  _state[idx].targetML     = 0.0f;
+
+  // Kick the pump on through the ramp (it applies the first duty right away)
+  _state[idx].duty = 0;
+  _state[idx].startUs = _state[idx].lastIntUs = hal::micros();
+  s_ramp.start(idx, duty, riseMs, fallMs, durMs, _state[idx].startUs);
+  s_stopTimer[idx].once_ms(durMs, onStopTimer, idx);
+}
+
+// Volume up to nowUs is booked at the old duty before the new one goes out,
+// so deliveredML follows the steps the ramp actually made
+void PumpControl::applyDuty(uint8_t idx, uint8_t duty, uint32_t nowUs) {
+  if (idx >= NUM_PUMPS) return;
+  PumpRuntime &s = _state[idx];
+  if (!s.running || s.cutPending) return;
+  integrate(idx, nowUs);
+  s.duty = duty;
+  writeDuty(idx, duty, s.reverse);
+}
+
+// Add the volume pumped at the applied duty since the last call
+void PumpControl::integrate(uint8_t idx, uint32_t nowUs) {
+  PumpRuntime &s = _state[idx];
+  uint32_t dt = nowUs - s.lastIntUs;
+  s.deliveredML += flowAt(settings.pump[idx], s.duty) * (dt / 1000000.0f);
+  s.lastIntUs = nowUs;
+}
 
-  // Kick the pump on using your existing helper (now shimmed)
-  writePump(idx, /*on=*/true, /*reverse=*/reverse);
+bool PumpControl::dose(uint8_t idx, float ml) {
+  if (idx >= NUM_PUMPS) return false;
+  const PumpConfig &pc = settings.pump[idx];
+  DosePlan plan = planDose(pc, ml);
+  if (!plan.totalMs()) return false;
+  startPump(idx, false, plan.totalMs(), plan.duty, plan.riseMs, plan.fallMs);
+  _state[idx].targetML = ml;
+  logInfo("Dose pump %u %.3f ml over %lu ms (rise %lu / fall %lu ms)", idx, ml, (unsigned long)plan.totalMs(),
+          (unsigned long)plan.riseMs, (unsigned long)plan.fallMs);
+  Logger::logEvent(LogEvent::Run, idx, plan.totalMs() / 1000.0f, plan.flowMlps, ml, plan.duty, 1);
+  return true;
+}
+
+void PumpControl::cutFromTimer(uint8_t idx) {
+  if (idx >= NUM_PUMPS) return;
+  PumpRuntime &s = _state[idx];
+  if (!s.running || s.cutPending) return;
+  s_ramp.cancel(idx);
+  hal::pwmWrite(idx, _pins[idx].pwm, 0);
+  s.cutUs = hal::micros();
+  s.cutPending = true;
 }
 
 void PumpControl::run(uint8_t idx, uint16_t seconds) {
-   startPump(idx, false, seconds);
+   startPump(idx, false, (uint32_t)seconds * 1000UL, settings.pump[idx].duty, settings.pump[idx].riseMs, settings.pump[idx].fallMs);
    float volume = seconds * settings.pump[idx].mlPerSec;
-  Serial.println("Run pump "+String(idx)+" for "+String(seconds)+" seconds");
-  Serial.println("ML/SEC "+String(settings.pump[idx].mlPerSec)+"  DUTY "+String(settings.pump[idx].duty)+" Target Volumne "+String(volume)+" ml");
-  Logger::logEvent(R, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  1);
+  logInfo("Run pump %u for %u seconds, %.2f ml/s at duty %u, target %.2f ml", idx, seconds,
+          settings.pump[idx].mlPerSec, settings.pump[idx].duty, volume);
+  Logger::logEvent(LogEvent::Run, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  1);
   }
 
 void PumpControl::prime(uint8_t idx, uint16_t seconds){
-   startPump(idx, false, seconds); 
+   startPump(idx, false, (uint32_t)seconds * 1000UL, settings.pump[idx].duty, settings.pump[idx].riseMs, settings.pump[idx].fallMs);
    float volume = seconds * settings.pump[idx].mlPerSec;
-   Logger::logEvent(P, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  1);
+   Logger::logEvent(LogEvent::Prime, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  1);
 }
 
 void PumpControl::purge(uint8_t idx, uint16_t seconds){
-   startPump(idx, true , seconds); 
+   startPump(idx, true, (uint32_t)seconds * 1000UL, settings.pump[idx].duty, settings.pump[idx].riseMs, settings.pump[idx].fallMs);
    float volume = seconds * settings.pump[idx].mlPerSec;
-   Logger::logEvent(G, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  -1);
+   Logger::logEvent(LogEvent::Purge, idx,seconds, settings.pump[idx].mlPerSec, volume, settings.pump[idx].duty,  -1);
 }
 
 void PumpControl::stop(uint8_t idx) {
   if (idx >= NUM_PUMPS) return;
+  s_stopTimer[idx].detach();
+  s_ramp.cancel(idx);
+  if (!_state[idx].cutPending) {
+    writePump(idx, false, false);
+    _state[idx].cutUs = hal::micros();
+  }
+  finishStop(idx, false);
+}
+
+// Bookkeeping after the PWM is already off: runtime and volume from the
+// measured on-time, overshoot for timed stops, then the Stop log record.
+void PumpControl::finishStop(uint8_t idx, bool timed) {
+  PumpRuntime &s = _state[idx];
+  if (s.running) integrate(idx, s.cutUs);
+  s.duty = 0;
   writePump(idx, false, false);
-  float timeN = millis();
-  float runTime =((timeN - _state[idx].startMs)/1000);
-  float deliveredML = roundf(_state[idx].deliveredML * 10.0f) / 10.0f;
-  Serial.println("Stop pump "+String(idx)+" after "+String(runTime)+" seconds"+"  Timenow "+String(timeN)+"  Start MS "+String(_state[idx].startMs) );
-  Serial.println("ML/SEC "+String(settings.pump[idx].mlPerSec)+"  DUTY "+String(settings.pump[idx].duty)+ "  Delivered Volumne "+String(deliveredML)+" ml");
-  Logger::logEvent(S, idx, runTime,settings.pump[idx].mlPerSec,  deliveredML, settings.pump[idx].duty,  0);
-  _state[idx].running = false;
-  _state[idx].durMs = 0;
+  uint32_t onUs = s.running ? s.cutUs - s.startUs : 0;
+  float runTime = onUs / 1000000.0f;
+  int32_t overUs = 0;
+  if (timed) {
+    overUs = (int32_t)(onUs - s.durMs * 1000UL);
+    s.overshootUs = overUs;
+  }
+  float deliveredML = roundf(s.deliveredML * 100.0f) / 100.0f;
+  logInfo("Stop pump %u after %.3f s, overshoot %ld us, delivered %.2f ml", idx, runTime, (long)overUs, deliveredML);
+  Logger::logEvent(LogEvent::Stop, idx, runTime, settings.pump[idx].mlPerSec, deliveredML, settings.pump[idx].duty, 0,
+                   LogStatus::None, overUs);
+  s.running = false;
+  s.cutPending = false;
+  s.durMs = 0;
+  s.stopMs = hal::millis() | 1;
 }
 
 bool PumpControl::isRunning(uint8_t idx) const {
   return (idx < NUM_PUMPS) ? _state[idx].running : false;
 }
 
+bool PumpControl::anyRunning() const {
+  for (int i = 0; i < NUM_PUMPS; ++i) if (_state[i].running) return true;
+  return false;
+}
+
 void PumpControl::loop() {
-  uint32_t now = millis();
+  uint32_t now = hal::millis();
   for (int i = 0; i < NUM_PUMPS; ++i) {
-    if (!_state[i].running) continue;
-    uint32_t elapsed = now - _state[i].startMs;
-    // integrate delivered ml
-    _state[i].deliveredML = (elapsed / 1000.0f) * settings.pump[i].mlPerSec;
-    if (elapsed >= _state[i].durMs) {
-     // Serial.println("elapsed "+String(elapsed)+"  durMs "+String(_state[i].durMs));  
-      stop(i);
+    PumpRuntime &s = _state[i];
+    if (!s.running) continue;
+    if (s.cutPending) { finishStop(i, true); continue; }
+    uint32_t nowUs = hal::micros();
+    uint32_t elapsed = now - s.startMs;
+    // keep deliveredML current for the status page (the ramp books its own steps)
+    integrate(i, nowUs);
+    if (elapsed >= _state[i].durMs + PUMP_STOP_SLACK_MS) {   // timer did not fire: cut here, overshoot shows it
+      s_stopTimer[i].detach();
+      cutFromTimer(i);
+      finishStop(i, true);
     }
   }
 }
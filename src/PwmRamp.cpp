@@ -0,0 +1,68 @@
+#include "PwmRamp.h"
+#include "Hal.h"
+
+namespace {
+  void onRampTimer(PwmRamp *r) { r->step(); }
+}
+
+uint8_t PwmRamp::dutyAt(uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs, uint32_t tMs) {
+  if (tMs >= totalMs) return 0;
+  if (tMs < riseMs) return (uint8_t)((uint32_t)peak * tMs / riseMs);
+  uint32_t left = totalMs - tMs;
+  if (left < fallMs) return (uint8_t)((uint32_t)peak * left / fallMs);
+  return peak;
+}
+
+void PwmRamp::start(uint8_t ch, uint8_t peak, uint32_t riseMs, uint32_t fallMs, uint32_t totalMs, uint32_t startUs) {
+  if (ch >= NUM_PUMPS) return;
+  if (riseMs + fallMs > totalMs) {   // short run: shrink both edges in proportion
+    uint32_t sum = riseMs + fallMs;
+    riseMs = (uint64_t)riseMs * totalMs / sum;
+    fallMs = totalMs - riseMs;
+  }
+  Channel &c = _ch[ch];
+  c.peak = peak;
+  c.riseMs = riseMs;
+  c.fallMs = fallMs;
+  c.totalMs = totalMs;
+  c.startUs = startUs;
+  c.duty = dutyAt(peak, riseMs, fallMs, totalMs, 0);
+  c.active = (riseMs || fallMs);
+  if (_apply) _apply(ch, c.duty, startUs);
+  if (c.active) arm(startUs);
+}
+
+void PwmRamp::cancel(uint8_t ch) {
+  if (ch < NUM_PUMPS) _ch[ch].active = false;
+}
+
+// Update every ramping channel, then re-arm for the next change
+void PwmRamp::step() {
+  const uint32_t nowUs = hal::micros();
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+    Channel &c = _ch[i];
+    if (!c.active) continue;
+    uint32_t t = (nowUs - c.startUs) / 1000UL;
+    uint8_t d = dutyAt(c.peak, c.riseMs, c.fallMs, c.totalMs, t);
+    if (d != c.duty) {
+      c.duty = d;
+      if (_apply) _apply(i, d, nowUs);
+    }
+    if (t >= c.totalMs || (t >= c.riseMs && !c.fallMs)) c.active = false;   // nothing left to ramp
+  }
+  arm(nowUs);
+}
+
+void PwmRamp::arm(uint32_t nowUs) {
+  uint32_t wait = UINT32_MAX;
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+    const Channel &c = _ch[i];
+    if (!c.active) continue;
+    uint32_t t = (nowUs - c.startUs) / 1000UL;
+    uint32_t fallAt = c.totalMs - c.fallMs;
+    uint32_t w = (t < c.riseMs || t >= fallAt) ? RAMP_STEP_MS : fallAt - t;
+    if (w < wait) wait = w;
+  }
+  _timer.detach();
+  if (wait != UINT32_MAX) _timer.once_ms(max<uint32_t>(wait, 1), onRampTimer, this);
+}
@@ -1,78 +1,321 @@
 #include "Scheduler.h"
-#include "PumpControl.h"
+#include "Hal.h"
+#include "DoseSequencer.h"
+#include "Logger.h"
+#include "Trace.h"
+
+// Fire state is an append-only file of 8-byte records, replayed on boot and
+// rewritten compactly once it grows past SCHED_STATE_MAX_RECS. A dose costs
+// one small append instead of a settings.json rewrite. An occurrence is
+// written when its dose starts, not when it is queued: a reboot while the
+// sequencer still holds the job leaves it unrecorded, so it is planned again
+// (or caught up) instead of being lost.
+#ifndef SCHED_STATE_MAX_RECS
+#define SCHED_STATE_MAX_RECS 128
+#endif
 
 Scheduler scheduler;
 
+namespace {
+  const char *kStatePath = "/sched.bin";
+  const char *kStateTmp  = "/sched.tmp";
+  constexpr uint8_t kStateMagic = 0xD5;
+
+  struct __attribute__((packed)) FireRec {
+    uint32_t due;    // epoch of the occurrence handled
+    uint8_t pump;
+    uint8_t slot;
+    uint8_t magic;
+    uint8_t crc;     // crc8 of the bytes above
+  };
+  static_assert(sizeof(FireRec) == 8, "FireRec layout");
+
+  uint8_t crc8(const uint8_t *p, size_t n) {
+    uint8_t c = 0;
+    while (n--) {
+      c ^= *p++;
+      for (uint8_t b = 0; b < 8; ++b) c = (c & 0x80) ? uint8_t((c << 1) ^ 0x07) : uint8_t(c << 1);
+    }
+    return c;
+  }
+
+  // Epoch of `sec` past local midnight, `addDays` from the day in `day`.
+  // mktime applies the DST rule of that day, so a dose keeps its wall-clock
+  // time across transitions.
+  uint32_t localAt(const struct tm &day, uint32_t sec, int addDays = 0) {
+    struct tm t = day;
+    t.tm_mday += addDays;
+    t.tm_hour = sec / 3600;
+    t.tm_min = (sec / 60) % 60;
+    t.tm_sec = sec % 60;
+    t.tm_isdst = -1;
+    return (uint32_t)mktime(&t);
+  }
+
+  FireRec makeRec(uint8_t pump, uint8_t slot, uint32_t due) {
+    FireRec r = { due, pump, slot, kStateMagic, 0 };
+    r.crc = crc8((const uint8_t *)&r, sizeof(r) - 1);
+    return r;
+  }
+}
+
 void Scheduler::begin() {
-  // nothing
+  loadState();
+  _dirty = true;
+}
+
+void Scheduler::invalidate() {
+  _dirty = true;
+}
+
+void Scheduler::invalidate(uint8_t pump) {
+  if (pump < NUM_PUMPS) _dirtyPumps |= 1u << pump;
+}
+
+// Replay the fire-state file; a torn tail record just ends the replay.
+void Scheduler::loadState() {
+  _stateRecs = 0;
+  hal::File f = hal::fs().open(kStatePath, "r");
+  if (!f) return;
+  FireRec r;
+  while (f.read((uint8_t *)&r, sizeof(r)) == sizeof(r)) {
+    if (r.magic != kStateMagic || r.crc != crc8((const uint8_t *)&r, sizeof(r) - 1)) {
+      logWarn("sched: fire state damaged after %u records", _stateRecs);
+      break;
+    }
+    if (r.pump < NUM_PUMPS && r.slot < MAX_TIMES_PER_DAY) _lastFired[r.pump][r.slot] = _savedFired[r.pump][r.slot] = r.due;
+    _stateRecs++;
+  }
+  f.close();
+  if (_stateRecs >= SCHED_STATE_MAX_RECS) compactState();
+}
+
+// Rewrite the file with one record per slot whose dose has started
+bool Scheduler::compactState() {
+  hal::File f = hal::fs().open(kStateTmp, "w");
+  if (!f) return false;
+  uint16_t n = 0;
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p)
+    for (uint8_t t = 0; t < MAX_TIMES_PER_DAY; ++t) {
+      if (!_savedFired[p][t]) continue;
+      FireRec r = makeRec(p, t, _savedFired[p][t]);
+      f.write((const uint8_t *)&r, sizeof(r));
+      n++;
+    }
+  f.close();
+  if (!hal::fs().rename(kStateTmp, kStatePath)) return false;
+  _stateRecs = n;
+  return true;
+}
+
+// Handled in RAM: not planned or caught up again while the dose waits
+void Scheduler::markFired(uint8_t pump, uint8_t slot, uint32_t due) {
+  _lastFired[pump][slot] = due;
+}
+
+void Scheduler::commitFired(uint8_t pump, uint8_t slot, uint32_t due) {
+  if (pump >= NUM_PUMPS || slot >= MAX_TIMES_PER_DAY || due <= _savedFired[pump][slot]) return;
+  _savedFired[pump][slot] = due;
+  if (_stateRecs >= SCHED_STATE_MAX_RECS && compactState()) return;   // compaction already holds it
+  hal::File f = hal::fs().open(kStatePath, "a");
+  if (!f) { logErr("sched: cannot write %s", kStatePath); return; }
+  FireRec r = makeRec(pump, slot, due);
+  f.write((const uint8_t *)&r, sizeof(r));
+  f.close();
+  _stateRecs++;
 }
 
 bool Scheduler::timeNow(struct tm &out, time_t &epoch) const {
-  epoch = time(nullptr);
+  epoch = hal::now();
   if (epoch < 100000) return false; // not synced yet
   localtime_r(&epoch, &out);
   return true;
 }
 
-uint16_t Scheduler::secondsSinceMidnight(const struct tm &tmNow) const {
-  return uint16_t(tmNow.tm_hour * 3600 + tmNow.tm_min * 60 + tmNow.tm_sec);
+// Keep _timeline sorted by due (at most NUM_PUMPS * MAX_TIMES_PER_DAY entries)
+void Scheduler::insert(const DoseEvent &ev) {
+  uint8_t i = _count++;
+  while (i > 0 && _timeline[i - 1].due > ev.due) {
+    _timeline[i] = _timeline[i - 1];
+    i--;
+  }
+  _timeline[i] = ev;
 }
 
-void Scheduler::tryFire(uint8_t i, uint16_t nowSec, int yday) {
-  const PumpConfig &pc = settings.pump[i];
-  for (int t = 0; t < pc.timesCount; ++t) {
-    uint16_t due = pc.timesSec[t];
-    // fire when we cross the boundary: within this 1-second tick window
-    if (nowSec == due) {
-      auto &fs = _fired[i][t];
-      // prevent duplicate firing the same day or within 3s
-      if (fs.lastDay == yday && (millis() - fs.lastFireMs) < 3000) continue;
+void Scheduler::refreshNextDue() {
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) _nextDue[p] = 0;
+  for (uint8_t k = 0; k < _count; ++k) {
+    uint32_t &nd = _nextDue[_timeline[k].pump];
+    if (!nd) nd = _timeline[k].due;   // sorted: first hit is the earliest
+  }
+}
 
-      // seconds needed to deliver doseML at mlPerSec
-      float ml = pc.doseML[t];
-      float mls = max(0.01f, pc.mlPerSec);
-      uint16_t needSec = uint16_t(ceilf(ml / mls));
-      if (needSec > 0) {
-        pumpCtl.run(i, needSec);
+// Dose to deliver for an occurrence missed by more than graceSec, per the
+// catch-up policy; 0 means skip. "scaled" shrinks the dose by how much of
+// the gap to the pump's next slot has already gone by.
+float Scheduler::catchUpMl(const DoseEvent &ev, uint32_t lateSec) const {
+  const PumpConfig &pc = settings.pump[ev.pump];
+  const float ml = pc.doseML[ev.slot];
+  switch (settings.catchUp) {
+    case CatchUpPolicy::Late:
+      logInfo("sched: pump %u slot %u missed by %lus, firing late (%.2f ml)",
+              ev.pump, ev.slot, (unsigned long)lateSec, ml);
+      return ml;
+    case CatchUpPolicy::Scaled: {
+      uint32_t gap = 24UL * 3600UL;
+      for (uint8_t t = 0; t < pc.timesCount; ++t) {
+        if (t == ev.slot) continue;
+        uint32_t d = (pc.timesSec[t] + 24UL * 3600UL - pc.timesSec[ev.slot]) % (24UL * 3600UL);
+        if (d && d < gap) gap = d;
       }
-      fs.lastDay = yday;
-      fs.lastFireMs = millis();
+      float scaled = (lateSec < gap) ? ml * (1.0f - float(lateSec) / float(gap)) : 0.0f;
+      logInfo("sched: pump %u slot %u missed by %lus, firing scaled (%.2f of %.2f ml)",
+              ev.pump, ev.slot, (unsigned long)lateSec, scaled, ml);
+      return scaled;
     }
+    default:
+      logWarn("sched: pump %u slot %u missed by %lus, skipped", ev.pump, ev.slot, (unsigned long)lateSec);
+      return 0.0f;
   }
 }
 
-void Scheduler::loop() {
-  struct tm tmNow;
-  time_t epoch;
-  if (!timeNow(tmNow, epoch)) return;
+// Doses go through the sequencer, which starts them when the pump, the
+// power budget and the additive gaps allow, and commits `due` then
+void Scheduler::fire(uint8_t pump, float ml, const uint32_t *due) {
+  sequencer.enqueue(pump, ml, due);
+}
+
+// Queue the dose for one occurrence; a skip is final right away
+void Scheduler::decide(const DoseEvent &ev, float ml) {
+  markFired(ev.pump, ev.slot, ev.due);
+  if (ml > 0.0f) {
+    uint32_t due[MAX_TIMES_PER_DAY] = {};
+    due[ev.slot] = ev.due;
+    fire(ev.pump, ml, due);
+  } else {
+    commitFired(ev.pump, ev.slot, ev.due);
+  }
+}
 
-  uint16_t nowSec = secondsSinceMidnight(tmNow);
+// First timeline build after boot: every slot whose latest occurrence
+// passed (beyond the grace window) without being recorded as handled was
+// missed while the device was off. Decisions are summed per pump so one
+// dose covers them, and recorded once it starts so a second reboot does not
+// repeat them.
+void Scheduler::reconcile(uint32_t now, const struct tm &tmNow) {
+  float owed[NUM_PUMPS] = {};
+  uint32_t owedDue[NUM_PUMPS][MAX_TIMES_PER_DAY] = {};
   for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
-    tryFire(i, nowSec, tmNow.tm_yday);
+    const PumpConfig &pc = settings.pump[i];
+    for (uint8_t t = 0; t < pc.timesCount; ++t) {
+      uint32_t prev = localAt(tmNow, pc.timesSec[t]);
+      if (prev > now) prev = localAt(tmNow, pc.timesSec[t], -1);
+      if (prev + settings.graceSec >= now) continue;   // still inside the window, the timeline fires it
+      if (prev <= _lastFired[i][t]) continue;          // already handled
+      const DoseEvent ev = { prev, i, t };
+      if (!_lastFired[i][t]) {
+        logInfo("sched: pump %u slot %u has no fire history, not caught up", i, t);
+        decide(ev, 0.0f);
+      } else {
+        float ml = catchUpMl(ev, now - prev);
+        if (ml <= 0.0f) {
+          decide(ev, ml);
+        } else {
+          markFired(i, t, prev);
+          owed[i] += ml;
+          owedDue[i][t] = prev;
+        }
+      }
+    }
   }
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i)
+    if (owed[i] > 0.0f) fire(i, owed[i], owedDue[i]);
+  _reconciled = true;
 }
 
-uint32_t Scheduler::nextRunSec(uint8_t pumpIdx) const {
+// Next occurrence of every slot. Today's occurrence counts if it was not
+// fired yet and is still inside the grace window; otherwise tomorrow's.
+void Scheduler::planPump(uint8_t pump, uint32_t now, const struct tm &tmNow) {
+  const PumpConfig &pc = settings.pump[pump];
+  for (uint8_t t = 0; t < pc.timesCount; ++t) {
+    uint32_t due = localAt(tmNow, pc.timesSec[t]);
+    if (due <= _lastFired[pump][t] || due + settings.graceSec < now) due = localAt(tmNow, pc.timesSec[t], 1);
+    insert({ due, pump, t });
+  }
+}
+
+void Scheduler::rebuild(time_t now, const struct tm &tmNow) {
+  if (!_reconciled) reconcile((uint32_t)now, tmNow);
+  _count = 0;
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) planPump(i, (uint32_t)now, tmNow);
+  _builtYday = tmNow.tm_yday;
+  _dirty = false;
+  _dirtyPumps = 0;
+  refreshNextDue();
+}
+
+// Drop the events of the pumps in _dirtyPumps and plan their slots again;
+// the other pumps' events stay where they are
+void Scheduler::replan(time_t now, const struct tm &tmNow) {
+  uint8_t kept = 0;
+  for (uint8_t k = 0; k < _count; ++k)
+    if (!(_dirtyPumps & (1u << _timeline[k].pump))) _timeline[kept++] = _timeline[k];
+  _count = kept;
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i)
+    if (_dirtyPumps & (1u << i)) planPump(i, (uint32_t)now, tmNow);
+  _dirtyPumps = 0;
+  refreshNextDue();
+}
+
+void Scheduler::loop() {
+  TRACE_SCOPE("sched.loop");
+  if (!_dirty && !_dirtyPumps && (!_count || _timeline[0].due > (uint32_t)hal::now())) return;   // nothing due
+
   struct tm tmNow;
   time_t epoch;
-  if (!timeNow(tmNow, epoch)) return UINT32_MAX;
-  uint16_t nowSec = secondsSinceMidnight(tmNow);
+  if (!timeNow(tmNow, epoch)) return;
+  const uint32_t now = (uint32_t)epoch;
+  if (_dirty) rebuild(epoch, tmNow);
+  else if (_dirtyPumps) replan(epoch, tmNow);
 
-  const PumpConfig &pc = settings.pump[pumpIdx];
-  uint32_t best = UINT32_MAX;
+  // Catch up on everything due, including seconds missed while loop() was
+  // blocked. Anything later than the grace window (clock stepped forward)
+  // goes through the catch-up policy.
+  bool fired = false;
+  while (_count && _timeline[0].due <= now) {
+    DoseEvent ev = _timeline[0];
+    memmove(&_timeline[0], &_timeline[1], (--_count) * sizeof(DoseEvent));
 
-  // Today forward
-  for (int t = 0; t < pc.timesCount; ++t) {
-    uint16_t due = pc.timesSec[t];
-    if (due >= nowSec) {
-      best = min<uint32_t>(best, due - nowSec);
-    }
-  }
-  // If none left today, pick the earliest tomorrow
-  if (best == UINT32_MAX && pc.timesCount > 0) {
-    uint16_t earliest = 65535;
-    for (int t = 0; t < pc.timesCount; ++t) earliest = min<uint16_t>(earliest, pc.timesSec[t]);
-    best = 24UL*3600UL - nowSec + earliest;
+    uint32_t late = now - ev.due;
+    float ml = settings.pump[ev.pump].doseML[ev.slot];
+    if (late > settings.graceSec) ml = catchUpMl(ev, late);
+    else if (late) logWarn("sched: pump %u slot %u fired %lus late", ev.pump, ev.slot, (unsigned long)late);
+    decide(ev, ml);
+
+    // Same wall-clock time on the next day it has not passed yet
+    const uint32_t sec = settings.pump[ev.pump].timesSec[ev.slot];
+    ev.due = localAt(tmNow, sec);
+    if (ev.due <= now) ev.due = localAt(tmNow, sec, 1);
+    insert(ev);
+    fired = true;
   }
-  return best;
+  // Day rollover rebuild only after the due events were handled, so a stall
+  // or clock step across midnight cannot drop them
+  if (tmNow.tm_yday != _builtYday) rebuild(epoch, tmNow);
+  else if (fired) refreshNextDue();
+}
+
+uint32_t Scheduler::nextRunSec(uint8_t pumpIdx) const {
+  if (pumpIdx >= NUM_PUMPS || !_nextDue[pumpIdx]) return UINT32_MAX;
+  time_t now = hal::now();
+  if (now < 100000) return UINT32_MAX;
+  return (_nextDue[pumpIdx] > (uint32_t)now) ? _nextDue[pumpIdx] - (uint32_t)now : 0;
+}
+
+uint32_t Scheduler::msUntilNext() const {
+  if (_dirty || _dirtyPumps) return 0;
+  if (!_count) return UINT32_MAX;
+  time_t now = hal::now();
+  if (now < 100000) return 1000;   // wait for time sync
+  return (_timeline[0].due > (uint32_t)now) ? (_timeline[0].due - (uint32_t)now) * 1000UL : 0;
 }
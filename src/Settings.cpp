@@ -1,33 +1,49 @@
 #include "Settings.h"
-#include <LittleFS.h>
+#include "Hal.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include "Trace.h"
 
 Settings settings; // global
 
-static const char *kSettingsPath = "/settings.json";
+// settings.json from before the binary images; imported once, then removed
+static const char *kLegacyPath = "/settings.json";
 
-bool settingsLoad() {
-  if (!LittleFS.exists(kSettingsPath)) return settingsSave(); // write defaults
-  File f = LittleFS.open(kSettingsPath, "r");
+static bool importLegacyJson() {
+  hal::File f = hal::fs().open(kLegacyPath, "r");
   if (!f) return false;
-  String s = f.readString();
+  JsonDocument doc;
+  DeserializationError e = deserializeJson(doc, f);
   f.close();
-
   String err;
-  if (!settingsFromJson(s, err)) {
-    // if corrupted, keep defaults and save back
-    return settingsSave();
+  if (e || !settingsFromJson(doc.as<JsonVariantConst>(), err)) {
+    logWarn("settings: %s unreadable, using defaults", kLegacyPath);
+    return false;
   }
   return true;
 }
 
+bool settingsLoad() {
+  if (!SettingsStore::exists()) {   // first boot, or first boot after the JSON era
+    bool imported = importLegacyJson();
+    if (!settingsSave()) return false;
+    if (imported) hal::fs().remove(kLegacyPath);
+    return true;
+  }
+  // A missing or damaged section keeps its defaults and is written back
+  bool ok = true;
+  if (!SettingsStore::load(SettingsStore::kSystem)) ok &= SettingsStore::save(SettingsStore::kSystem);
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i)
+    if (!SettingsStore::load(i)) ok &= SettingsStore::save(i);
+  return ok;
+}
+
+// Sections whose image did not change are not rewritten
 bool settingsSave() {
-  File f = LittleFS.open(kSettingsPath, "w");
-  if (!f) return false;
-  String s = settingsToJson();
-  f.print(s);
-  Serial.println("Settings saved: " + s);
-  f.close();
-  return true;
+  TRACE_SCOPE("settings.save");
+  bool ok = SettingsStore::save(SettingsStore::kSystem);
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) ok &= SettingsStore::save(i);
+  return ok;
 }
 
 String settingsToJson() {
@@ -38,6 +54,12 @@ String settingsToJson() {
   doc["hostname"] = settings.hostname;
   doc["tzOffsetMinutes"] = settings.tzOffsetMinutes;
   doc["useDST"] = settings.useDST;
+  doc["graceSec"] = settings.graceSec;
+  doc["catchUp"] = catchUpName(settings.catchUp);
+  doc["maxConcurrent"] = settings.maxConcurrent;
+  doc["supplyMa"] = settings.supplyMa;
+  doc["staggerMs"] = settings.staggerMs;
+  doc["incompatGapSec"] = settings.incompatGapSec;
 
   JsonArray arr = doc["pumps"].to<JsonArray>();
   for (int i = 0; i < NUM_PUMPS; ++i) {
@@ -47,6 +69,20 @@ String settingsToJson() {
     p["duty"] = settings.pump[i].duty;
     p["defaultRunSec"] = settings.pump[i].defaultRunSec;
     p["dirForward"] = settings.pump[i].dirForward;
+    p["riseMs"] = settings.pump[i].riseMs;
+    p["fallMs"] = settings.pump[i].fallMs;
+    p["currentMa"] = settings.pump[i].currentMa;
+
+    JsonArray inc = p["incompat"].to<JsonArray>();
+    for (int k = 0; k < NUM_PUMPS; ++k)
+      if (settings.pump[i].incompatMask & (1u << k)) inc.add(k);
+
+    JsonArray cal = p["cal"].to<JsonArray>();
+    for (int k = 0; k < settings.pump[i].calCount; ++k) {
+      JsonObject c = cal.add<JsonObject>();
+      c["duty"] = settings.pump[i].cal[k].duty;
+      c["mlps"] = settings.pump[i].cal[k].mlPerSec;
+    }
 
     JsonArray times = p["times"].to<JsonArray>();
     for (int t = 0; t < settings.pump[i].timesCount; ++t) {
@@ -61,44 +97,165 @@ String settingsToJson() {
   return out;
 }
 
+const char *catchUpName(CatchUpPolicy p) {
+  switch (p) {
+    case CatchUpPolicy::Late:   return "late";
+    case CatchUpPolicy::Scaled: return "scaled";
+    default:                    return "skip";
+  }
+}
+
 // helper to clamp
 static uint8_t clamp_u8(uint32_t v) { return (v > 255) ? 255 : (uint8_t)v; }
 static uint16_t clamp_u16(uint32_t v){ return (v > 65535) ? 65535 : (uint16_t)v; }
 
+// Fields present in p are applied to pc; absent ones keep their value.
+// "times" replaces the whole schedule.
+static void applyPump(PumpConfig &pc, int idx, JsonObjectConst p) {
+  pc.mlPerSec = p["mlPerSec"] | pc.mlPerSec;
+  pc.duty = clamp_u8(p["duty"] | pc.duty);
+  pc.defaultRunSec = clamp_u16(p["defaultRunSec"] | pc.defaultRunSec);
+  pc.dirForward = clamp_u8(p["dirForward"] | pc.dirForward) ? 1 : 0;
+  if (p["rampMs"].is<unsigned>()) pc.riseMs = pc.fallMs = clamp_u16(p["rampMs"].as<uint32_t>());   // older single ramp time
+  pc.riseMs = clamp_u16(p["riseMs"] | pc.riseMs);
+  pc.fallMs = clamp_u16(p["fallMs"] | pc.fallMs);
+  pc.currentMa = clamp_u16(p["currentMa"] | pc.currentMa);
+  if (p["incompat"].is<JsonArrayConst>()) {
+    uint8_t mask = 0;
+    for (int k : p["incompat"].as<JsonArrayConst>())
+      if (k >= 0 && k < NUM_PUMPS && k != idx) mask |= 1u << k;
+    pc.incompatMask = mask;
+  }
+
+  // calibration, kept sorted by duty (one point per duty)
+  if (p["cal"].is<JsonArrayConst>()) {
+    pc.calCount = 0;
+    for (JsonObjectConst o : p["cal"].as<JsonArrayConst>()) {
+      if (pc.calCount >= MAX_CAL_POINTS) break;
+      uint8_t duty = clamp_u8(o["duty"] | 0);
+      float mlps   = o["mlps"] | 0.0f;
+      if (!duty || mlps < 0.0f) continue;
+      uint8_t k = pc.calCount;
+      while (k > 0 && pc.cal[k - 1].duty > duty) { pc.cal[k] = pc.cal[k - 1]; k--; }
+      if (k > 0 && pc.cal[k - 1].duty == duty) {   // duplicate duty: last one wins
+        for (uint8_t m = k; m < pc.calCount; ++m) pc.cal[m] = pc.cal[m + 1];
+        pc.cal[k - 1].mlPerSec = mlps;
+        continue;
+      }
+      pc.cal[k] = { duty, mlps };
+      pc.calCount++;
+    }
+  }
+
+  // times
+  if (p["times"].is<JsonArrayConst>()) {
+    pc.timesCount = 0;
+    for (JsonObjectConst o : p["times"].as<JsonArrayConst>()) {
+      if (pc.timesCount >= MAX_TIMES_PER_DAY) break;
+      uint32_t sec = o["sec"] | 0u;
+      float ml     = o["ml"]  | 0.0f;
+      if (sec >= 24UL * 3600UL) continue;
+      pc.timesSec[pc.timesCount] = sec;
+      pc.doseML[pc.timesCount]   = ml;
+      pc.timesCount++;
+    }
+  }
+}
+
 bool settingsFromJson(const String &body, String &err) {
   JsonDocument doc;
-  DeserializationError e = deserializeJson(doc, body);
+  DeserializationError e = deserializeJson(doc, body.c_str(), body.length());
   if (e) { err = e.c_str(); return false; }
+  return settingsFromJson(doc.as<JsonVariantConst>(), err);
+}
+
+bool settingsFromJson(JsonVariantConst doc, String &err) {
+  if (!doc.is<JsonObjectConst>()) { err = "expected object"; return false; }
+
+  // Everything that can be rejected is checked before anything is applied
+  CatchUpPolicy catchUp = settings.catchUp;
+  if (doc["catchUp"].is<const char*>()) {
+    const char *cu = doc["catchUp"];
+    if      (strcmp(cu, "skip") == 0)   catchUp = CatchUpPolicy::Skip;
+    else if (strcmp(cu, "late") == 0)   catchUp = CatchUpPolicy::Late;
+    else if (strcmp(cu, "scaled") == 0) catchUp = CatchUpPolicy::Scaled;
+    else { err = "bad catchUp"; return false; }
+  }
+  // A pump drawing more than the whole supply budget could never be started
+  const uint16_t supplyMa = clamp_u16(doc["supplyMa"] | settings.supplyMa);
+  for (uint8_t i = 0; supplyMa && i < NUM_PUMPS; ++i) {
+    uint16_t ma = settings.pump[i].currentMa;
+    for (JsonObjectConst p : doc["pumps"].as<JsonArrayConst>())
+      if ((p["idx"] | -1) == i) ma = clamp_u16(p["currentMa"] | ma);
+    if (ma > supplyMa) { err = "currentMa over supplyMa"; return false; }
+  }
 
   if (doc["wifi"]["ssid"].is<const char*>()) strlcpy(settings.wifiSsid, doc["wifi"]["ssid"]|"", sizeof(settings.wifiSsid));
   if (doc["wifi"]["pass"].is<const char*>()) strlcpy(settings.wifiPass, doc["wifi"]["pass"]|"", sizeof(settings.wifiPass));
   if (doc["hostname"].is<const char*>())     strlcpy(settings.hostname, doc["hostname"]|"", sizeof(settings.hostname));
   settings.tzOffsetMinutes = doc["tzOffsetMinutes"] | settings.tzOffsetMinutes;
   settings.useDST = doc["useDST"] | settings.useDST;
+  settings.graceSec = clamp_u16(doc["graceSec"] | settings.graceSec);
+  settings.catchUp = catchUp;
+  settings.maxConcurrent = constrain((int)(doc["maxConcurrent"] | settings.maxConcurrent), 1, (int)NUM_PUMPS);
+  settings.supplyMa = supplyMa;
+  settings.staggerMs = clamp_u16(doc["staggerMs"] | settings.staggerMs);
+  settings.incompatGapSec = clamp_u16(doc["incompatGapSec"] | settings.incompatGapSec);
 
-  if (doc["pumps"].is<JsonArray>()) {
-    JsonArray arr = doc["pumps"].as<JsonArray>();
-    for (JsonObject p : arr) {
+  if (doc["pumps"].is<JsonArrayConst>()) {
+    JsonArrayConst arr = doc["pumps"].as<JsonArrayConst>();
+    for (JsonObjectConst p : arr) {
       int idx = p["idx"] | -1;
       if (idx < 0 || idx >= NUM_PUMPS) continue;
-      settings.pump[idx].mlPerSec = p["mlPerSec"] | settings.pump[idx].mlPerSec;
-      settings.pump[idx].duty = clamp_u8(p["duty"] | settings.pump[idx].duty);
-      settings.pump[idx].defaultRunSec = clamp_u16(p["defaultRunSec"] | settings.pump[idx].defaultRunSec);
-      settings.pump[idx].dirForward = clamp_u8(p["dirForward"] | settings.pump[idx].dirForward) ? 1 : 0;
-
-      // times
-      settings.pump[idx].timesCount = 0;
-      if (p["times"].is<JsonArray>()) {
-        for (JsonObject o : p["times"].as<JsonArray>()) {
-          if (settings.pump[idx].timesCount >= MAX_TIMES_PER_DAY) break;
-          uint16_t sec = o["sec"] | 0;
-          float ml     = o["ml"]  | 0.0f;
-          settings.pump[idx].timesSec[settings.pump[idx].timesCount] = sec;
-          settings.pump[idx].doseML[settings.pump[idx].timesCount]   = ml;
-          settings.pump[idx].timesCount++;
-        }
-      }
+      applyPump(settings.pump[idx], idx, p);
+      if (!p["times"].is<JsonArrayConst>()) settings.pump[idx].timesCount = 0;   // full document: no times = no schedule
     }
   }
   return true;
 }
+
+// JSON Merge Patch (RFC 7396) of one pump: only the members present change,
+// "times" replaces the schedule and "times": null clears it. The patched
+// config goes to `out` only if the whole patch is valid; settings are not
+// touched.
+bool pumpPatchFromJson(uint8_t idx, JsonVariantConst patch, PumpConfig &out, String &err) {
+  static const char *const kKeys[] = { "mlPerSec", "duty", "defaultRunSec", "dirForward", "rampMs", "riseMs",
+                                       "fallMs", "currentMa", "incompat", "cal", "times" };
+  if (idx >= NUM_PUMPS) { err = "bad idx"; return false; }
+  if (!patch.is<JsonObjectConst>()) { err = "expected object"; return false; }
+
+  bool clearTimes = false;
+  for (JsonPairConst kv : patch.as<JsonObjectConst>()) {
+    const char *key = kv.key().c_str();
+    bool known = false;
+    for (const char *k : kKeys) known |= strcmp(key, k) == 0;
+    if (!known) { err = String("unknown field ") + key; return false; }
+    if (kv.value().isNull()) {
+      if (strcmp(key, "times") != 0) { err = String(key) + " cannot be removed"; return false; }
+      clearTimes = true;
+    }
+  }
+  if (patch["times"].is<JsonArrayConst>()) {
+    for (JsonObjectConst o : patch["times"].as<JsonArrayConst>())
+      if ((o["sec"] | 0u) >= 24UL * 3600UL) { err = "bad times.sec"; return false; }
+  }
+  if (settings.supplyMa && clamp_u16(patch["currentMa"] | 0u) > settings.supplyMa) { err = "currentMa over supplyMa"; return false; }
+
+  PumpConfig pc = settings.pump[idx];
+  applyPump(pc, idx, patch.as<JsonObjectConst>());
+  if (clearTimes) pc.timesCount = 0;
+  out = pc;
+  return true;
+}
+
+// SettingsStore writes the section from `settings`, so the new config goes
+// in first and comes back out if the write fails
+bool settingsSavePump(uint8_t idx, const PumpConfig &pc) {
+  TRACE_SCOPE("settings.save_pump");
+  if (idx >= NUM_PUMPS) return false;
+  const PumpConfig old = settings.pump[idx];
+  settings.pump[idx] = pc;
+  if (SettingsStore::save(idx)) return true;
+  settings.pump[idx] = old;
+  return false;
+}
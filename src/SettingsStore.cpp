@@ -0,0 +1,316 @@
+#include "SettingsStore.h"
+#include "Hal.h"
+#include "Logger.h"
+#include <stddef.h>
+#include <type_traits>
+
+namespace {
+  constexpr uint32_t kImageMagic = 0x54455344;   // "DSET"
+  // Bump only when a field keeps its id but changes meaning; width and
+  // count changes are handled by the per-field conversion below.
+  constexpr uint8_t kSchemaVersion = 1;
+
+  struct __attribute__((packed)) ImageHdr {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t section;
+    uint16_t len;      // payload bytes after the header
+    uint32_t crc;      // crc32 of the payload
+  };
+
+  // Stored element types; the numbering is part of the file format
+  enum class FType : uint8_t { U8 = 1, U16, U32, I16, I32, F32, Bool, Str };
+
+  constexpr uint8_t typeSize(FType t) {
+    return (t == FType::U8 || t == FType::Bool || t == FType::Str) ? 1
+         : (t == FType::U16 || t == FType::I16) ? 2
+         : (t == FType::U32 || t == FType::I32 || t == FType::F32) ? 4 : 0;
+  }
+
+  template <typename M> struct TypeOf;
+  template <> struct TypeOf<uint8_t>       { static constexpr FType v = FType::U8; };
+  template <> struct TypeOf<uint16_t>      { static constexpr FType v = FType::U16; };
+  template <> struct TypeOf<uint32_t>      { static constexpr FType v = FType::U32; };
+  template <> struct TypeOf<int16_t>       { static constexpr FType v = FType::I16; };
+  template <> struct TypeOf<int32_t>       { static constexpr FType v = FType::I32; };
+  template <> struct TypeOf<float>         { static constexpr FType v = FType::F32; };
+  template <> struct TypeOf<bool>          { static constexpr FType v = FType::Bool; };
+  template <> struct TypeOf<char>          { static constexpr FType v = FType::Str; };
+  template <> struct TypeOf<CatchUpPolicy> { static constexpr FType v = FType::U8; };
+
+  // One schema entry: `count` elements `stride` bytes apart, starting at
+  // `offset` inside the section struct (strings: count = buffer size).
+  // `limit` caps a u8 element count on load (0 = no cap).
+  struct Field {
+    uint8_t id;
+    FType type;
+    uint8_t count;
+    uint16_t offset;
+    uint8_t stride;
+    uint8_t limit;
+  };
+
+  template <typename M>
+  constexpr Field makeField(uint8_t id, size_t offset, size_t bytes, size_t stride, uint8_t limit = 0) {
+    static_assert(sizeof(M) == typeSize(TypeOf<M>::v), "settings field type does not match its storage size");
+    return { id, TypeOf<M>::v, uint8_t(bytes / sizeof(M)), uint16_t(offset), uint8_t(stride), limit };
+  }
+
+  // Member (scalar or array) of the section struct S
+  #define SETTING(S, id, m) \
+    makeField<std::remove_all_extents<decltype(S::m)>::type>(id, offsetof(S, m), sizeof(S::m), \
+                                                               sizeof(std::remove_all_extents<decltype(S::m)>::type))
+  // Count of the used elements of a fixed array, never more than `max`
+  #define SETTING_COUNT(S, id, m, max) \
+    makeField<decltype(S::m)>(id, offsetof(S, m), sizeof(S::m), sizeof(S::m), max)
+  // Member m of every element of the struct array S::arr (element type E)
+  #define SETTING_OF(S, id, arr, E, m) \
+    makeField<decltype(E::m)>(id, offsetof(S, arr) + offsetof(E, m), sizeof(S::arr) / sizeof(E) * sizeof(E::m), sizeof(E))
+
+  // Field ids are the file format: never renumber or reuse one.
+  constexpr Field kSystemFields[] = {
+    SETTING(Settings, 1, wifiSsid),
+    SETTING(Settings, 2, wifiPass),
+    SETTING(Settings, 3, hostname),
+    SETTING(Settings, 4, tzOffsetMinutes),
+    SETTING(Settings, 5, useDST),
+    SETTING(Settings, 6, graceSec),
+    SETTING(Settings, 7, catchUp),
+    SETTING(Settings, 8, maxConcurrent),
+    SETTING(Settings, 9, supplyMa),
+    SETTING(Settings, 10, staggerMs),
+    SETTING(Settings, 11, incompatGapSec),
+  };
+
+  constexpr Field kPumpFields[] = {
+    SETTING(PumpConfig, 1, mlPerSec),
+    SETTING(PumpConfig, 2, duty),
+    SETTING(PumpConfig, 3, defaultRunSec),
+    SETTING(PumpConfig, 4, dirForward),
+    SETTING_COUNT(PumpConfig, 5, calCount, MAX_CAL_POINTS),
+    SETTING_OF(PumpConfig, 6, cal, CalPoint, duty),
+    SETTING_OF(PumpConfig, 7, cal, CalPoint, mlPerSec),
+    SETTING(PumpConfig, 8, riseMs),
+    SETTING(PumpConfig, 9, fallMs),
+    SETTING(PumpConfig, 10, currentMa),
+    SETTING(PumpConfig, 11, incompatMask),
+    SETTING_COUNT(PumpConfig, 12, timesCount, MAX_TIMES_PER_DAY),
+    SETTING(PumpConfig, 13, timesSec),
+    SETTING(PumpConfig, 14, doseML),
+  };
+
+  #undef SETTING
+  #undef SETTING_COUNT
+  #undef SETTING_OF
+
+  template <size_t N>
+  constexpr bool uniqueIds(const Field (&f)[N]) {
+    for (size_t i = 0; i < N; ++i)
+      for (size_t j = i + 1; j < N; ++j)
+        if (f[i].id == f[j].id) return false;
+    return true;
+  }
+  static_assert(uniqueIds(kSystemFields), "duplicate system settings field id");
+  static_assert(uniqueIds(kPumpFields), "duplicate pump settings field id");
+
+  template <size_t N>
+  constexpr bool limitsOnU8(const Field (&f)[N]) {
+    for (size_t i = 0; i < N; ++i)
+      if (f[i].limit && (f[i].type != FType::U8 || f[i].count != 1)) return false;
+    return true;
+  }
+  static_assert(limitsOnU8(kSystemFields) && limitsOnU8(kPumpFields), "count limits apply to scalar u8 fields");
+
+  // Encoded payload size: a 3-byte tag (id, type, count) plus the elements
+  template <size_t N>
+  constexpr size_t payloadBytes(const Field (&f)[N]) {
+    size_t n = 0;
+    for (size_t i = 0; i < N; ++i) n += 3 + f[i].count * typeSize(f[i].type);
+    return n;
+  }
+  constexpr size_t kMaxPayload = payloadBytes(kSystemFields) > payloadBytes(kPumpFields)
+                                   ? payloadBytes(kSystemFields) : payloadBytes(kPumpFields);
+  static_assert(kMaxPayload <= 0xFFFF, "settings image too large");
+
+  struct Section {
+    const Field *fields;
+    size_t count;
+    uint8_t *base;
+  };
+
+  Section sectionOf(uint8_t section) {
+    if (section == SettingsStore::kSystem)
+      return { kSystemFields, sizeof(kSystemFields) / sizeof(Field), (uint8_t *)&settings };
+    if (section < NUM_PUMPS)
+      return { kPumpFields, sizeof(kPumpFields) / sizeof(Field), (uint8_t *)&settings.pump[section] };
+    return { nullptr, 0, nullptr };
+  }
+
+  void pathOf(uint8_t section, char *out, size_t cap, const char *ext) {
+    if (section == SettingsStore::kSystem) snprintf(out, cap, "/cfg_sys.%s", ext);
+    else snprintf(out, cap, "/cfg_p%u.%s", section, ext);
+  }
+
+  uint32_t crc32(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    while (n--) {
+      crc ^= *p++;
+      for (uint8_t b = 0; b < 8; ++b) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+  }
+
+  const Field *findField(const Section &s, uint8_t id) {
+    for (size_t i = 0; i < s.count; ++i)
+      if (s.fields[i].id == id) return &s.fields[i];
+    return nullptr;
+  }
+
+  // One stored element into the field's current type: integers are clamped
+  // to the new range and floats rounded, so a widened or retyped field
+  // loads from an older image without a hand-written migration.
+  void convert(FType from, const uint8_t *src, FType to, uint8_t *dst) {
+    int64_t i = 0;
+    float f = 0.0f;
+    bool isFloat = false;
+    switch (from) {
+      case FType::U8:
+      case FType::Bool: i = src[0]; break;
+      case FType::U16: { uint16_t v; memcpy(&v, src, 2); i = v; break; }
+      case FType::I16: { int16_t v;  memcpy(&v, src, 2); i = v; break; }
+      case FType::U32: { uint32_t v; memcpy(&v, src, 4); i = v; break; }
+      case FType::I32: { int32_t v;  memcpy(&v, src, 4); i = v; break; }
+      case FType::F32: memcpy(&f, src, 4); isFloat = true; break;
+      default: return;
+    }
+    if (isFloat) i = (int64_t)lroundf(f);
+    else f = (float)i;
+
+    auto clampTo = [&](int64_t lo, int64_t hi) { return i < lo ? lo : (i > hi ? hi : i); };
+    switch (to) {
+      case FType::U8:   dst[0] = (uint8_t)clampTo(0, 0xFF); break;
+      case FType::Bool: dst[0] = (isFloat ? f != 0.0f : i != 0) ? 1 : 0; break;
+      case FType::U16:  { uint16_t v = (uint16_t)clampTo(0, 0xFFFF);            memcpy(dst, &v, 2); break; }
+      case FType::I16:  { int16_t v  = (int16_t)clampTo(INT16_MIN, INT16_MAX);  memcpy(dst, &v, 2); break; }
+      case FType::U32:  { uint32_t v = (uint32_t)clampTo(0, 0xFFFFFFFFLL);      memcpy(dst, &v, 4); break; }
+      case FType::I32:  { int32_t v  = (int32_t)clampTo(INT32_MIN, INT32_MAX);  memcpy(dst, &v, 4); break; }
+      case FType::F32:  memcpy(dst, &f, 4); break;
+      default: break;
+    }
+  }
+
+  size_t encode(const Section &s, uint8_t *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < s.count; ++i) {
+      const Field &fd = s.fields[i];
+      const uint8_t sz = typeSize(fd.type);
+      out[n++] = fd.id;
+      out[n++] = (uint8_t)fd.type;
+      out[n++] = fd.count;
+      for (uint8_t k = 0; k < fd.count; ++k, n += sz) memcpy(out + n, s.base + fd.offset + k * fd.stride, sz);
+    }
+    return n;
+  }
+
+  // Walk the tagged fields of a CRC-checked payload (file positioned just
+  // after the header). Unknown ids and elements past a field's current
+  // count are skipped; fields missing from the image keep their value.
+  // A count above its array size (an image from a build with larger
+  // arrays, or a bad one that still has a valid CRC) is cut to the array.
+  bool walk(hal::File &f, size_t len, const Section &s, bool apply) {
+    size_t pos = 0;
+    while (pos < len) {
+      uint8_t tag[3];
+      if (len - pos < sizeof(tag) || f.read(tag, sizeof(tag)) != sizeof(tag)) return false;
+      pos += sizeof(tag);
+      const FType type = (FType)tag[1];
+      const uint8_t sz = typeSize(type);
+      if (!sz || len - pos < (size_t)tag[2] * sz) return false;
+      const Field *fd = apply ? findField(s, tag[0]) : nullptr;
+      if (fd && (fd->type == FType::Str) != (type == FType::Str)) fd = nullptr;   // string <-> number: drop
+      for (uint8_t k = 0; k < tag[2]; ++k, pos += sz) {
+        uint8_t v[4];
+        if (f.read(v, sz) != sz) return false;
+        if (!fd || k >= fd->count) continue;
+        uint8_t *dst = s.base + fd->offset + k * fd->stride;
+        if (fd->type == FType::Str) *dst = v[0];
+        else convert(type, v, fd->type, dst);
+        if (fd->limit && *dst > fd->limit) {
+          logWarn("settings: field %u holds %u, more than %u", fd->id, *dst, fd->limit);
+          *dst = fd->limit;
+        }
+      }
+      if (fd && fd->type == FType::Str) s.base[fd->offset + fd->count - 1] = '\0';
+    }
+    return true;
+  }
+}
+
+bool SettingsStore::exists() {
+  char path[20];
+  pathOf(kSystem, path, sizeof(path), "bin");
+  return hal::fs().exists(path);
+}
+
+bool SettingsStore::load(uint8_t section) {
+  const Section s = sectionOf(section);
+  if (!s.base) return false;
+  char path[20];
+  pathOf(section, path, sizeof(path), "bin");
+  hal::File f = hal::fs().open(path, "r");
+  if (!f) return false;
+
+  ImageHdr h;
+  bool ok = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) && h.magic == kImageMagic && h.section == section;
+  if (ok) {   // CRC first, so a damaged image changes nothing
+    uint32_t crc = 0;
+    uint8_t chunk[64];
+    size_t left = h.len;
+    while (left) {
+      size_t n = f.read(chunk, left < sizeof(chunk) ? left : sizeof(chunk));
+      if (!n) break;
+      crc = crc32(crc, chunk, n);
+      left -= n;
+    }
+    ok = !left && crc == h.crc;
+  }
+  ok = ok && f.seek(sizeof(h)) && walk(f, h.len, s, false);
+  ok = ok && f.seek(sizeof(h)) && walk(f, h.len, s, true);
+  f.close();
+  if (!ok) logWarn("settings: %s is damaged", path);
+  else if (h.version > kSchemaVersion) logWarn("settings: %s is from a newer schema (v%u)", path, h.version);
+  return ok;
+}
+
+bool SettingsStore::save(uint8_t section) {
+  const Section s = sectionOf(section);
+  if (!s.base) return false;
+  uint8_t payload[kMaxPayload];
+  const size_t len = encode(s, payload);
+  const ImageHdr h = { kImageMagic, kSchemaVersion, section, (uint16_t)len, crc32(0, payload, len) };
+
+  char path[20], tmp[20];
+  pathOf(section, path, sizeof(path), "bin");
+  pathOf(section, tmp, sizeof(tmp), "tmp");
+
+  // Same image already on flash: nothing to write
+  hal::File f = hal::fs().open(path, "r");
+  if (f) {
+    ImageHdr old;
+    bool same = f.size() == sizeof(h) + len && f.read((uint8_t *)&old, sizeof(old)) == sizeof(old) &&
+                memcmp(&old, &h, sizeof(h)) == 0;
+    f.close();
+    if (same) return true;
+  }
+
+  f = hal::fs().open(tmp, "w");
+  if (!f) return false;
+  bool ok = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) && f.write(payload, len) == len;
+  f.close();
+  if (!ok || !hal::fs().rename(tmp, path)) {
+    hal::fs().remove(tmp);
+    logErr("settings: writing %s failed", path);
+    return false;
+  }
+  return true;
+}
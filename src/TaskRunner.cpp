@@ -0,0 +1,107 @@
+#include "TaskRunner.h"
+#include "Hal.h"
+
+#ifndef TASK_MAX
+#define TASK_MAX 12         // main.cpp registers 7, 8 with TRACE_ENABLED
+#endif
+#ifndef TASK_MAX_SLEEP_MS
+#define TASK_MAX_SLEEP_MS 10    // upper bound on one idle sleep
+#endif
+
+namespace {
+  struct Task {
+    TaskInfo info;
+    TaskFn fn;
+    uint32_t dueMs;
+  };
+  Task s_tasks[TASK_MAX];
+  uint8_t s_count = 0;
+  uint64_t s_idleUs = 0;
+  PassWindow s_passes = { 0, UINT32_MAX, 0, 0 };
+}
+
+int Tasks::add(const char *name, TaskFn fn, uint32_t periodMs, uint32_t deadlineMs) {
+  if (s_count >= TASK_MAX || !fn) return -1;
+  Task &t = s_tasks[s_count];
+  t.info = { name, periodMs, deadlineMs, {} };
+  t.fn = fn;
+  t.dueMs = hal::millis();
+  return s_count++;
+}
+
+// One pass: every task that is due runs once, earliest deadline first.
+// Sleeps until the next due time only when nothing ran.
+void Tasks::run() {
+  bool ran[TASK_MAX] = {};
+  bool ranAny = false;
+  const uint32_t passT0 = hal::micros();
+  for (;;) {
+    const uint32_t now = hal::millis();
+    int pick = -1;
+    for (uint8_t i = 0; i < s_count; ++i) {
+      const Task &t = s_tasks[i];
+      if (ran[i] || (int32_t)(now - t.dueMs) < 0) continue;
+      if (pick < 0) { pick = i; continue; }
+      const Task &p = s_tasks[pick];
+      if ((int32_t)((t.dueMs + t.info.deadlineMs) - (p.dueMs + p.info.deadlineMs)) < 0) pick = i;
+    }
+    if (pick < 0) break;
+
+    Task &t = s_tasks[pick];
+    TaskStats &st = t.info.stats;
+    uint32_t late = now - t.dueMs;
+    if (late > st.lateMaxMs) st.lateMaxMs = late;
+    st.lateTotalMs += late;
+    if (late > t.info.deadlineMs) st.missed++;
+
+    uint32_t t0 = hal::micros();
+    t.fn();
+    uint32_t us = hal::micros() - t0;
+    st.runs++;
+    st.lastUs = us;
+    st.totalUs += us;
+    if (us > st.maxUs) st.maxUs = us;
+
+    // Next slot on the period grid; after an overrun start again from now
+    // instead of a burst of back-to-back catch-up runs.
+    t.dueMs += t.info.periodMs;
+    if ((int32_t)(hal::millis() - t.dueMs) > 0) t.dueMs = hal::millis();
+    ran[pick] = true;
+    ranAny = true;
+  }
+  if (ranAny) {
+    const uint32_t us = hal::micros() - passT0;
+    s_passes.passes++;
+    s_passes.totalUs += us;
+    if (us < s_passes.minUs) s_passes.minUs = us;
+    if (us > s_passes.maxUs) s_passes.maxUs = us;
+    return;
+  }
+
+  // Nothing due: sleep until the next task (the wait lets the WiFi/SYS tasks run)
+  uint32_t wait = TASK_MAX_SLEEP_MS;
+  const uint32_t now = hal::millis();
+  for (uint8_t i = 0; i < s_count; ++i) {
+    int32_t d = (int32_t)(s_tasks[i].dueMs - now);
+    if (d < (int32_t)wait) wait = (d < 0) ? 0 : (uint32_t)d;
+  }
+  uint32_t t0 = hal::micros();
+  if (wait) hal::sleepMs(wait); else hal::yield();
+  s_idleUs += hal::micros() - t0;
+}
+
+uint8_t Tasks::count() { return s_count; }
+const TaskInfo &Tasks::info(uint8_t id) { return s_tasks[id].info; }
+uint64_t Tasks::idleUs() { return s_idleUs; }
+
+PassWindow Tasks::takePasses() {
+  PassWindow w = s_passes;
+  if (!w.passes) w.minUs = 0;
+  s_passes = { 0, UINT32_MAX, 0, 0 };
+  return w;
+}
+
+void Tasks::resetStats() {
+  for (uint8_t i = 0; i < s_count; ++i) s_tasks[i].info.stats = {};
+  s_idleUs = 0;
+}
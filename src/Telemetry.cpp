@@ -0,0 +1,64 @@
+#include "Telemetry.h"
+#include <ESP8266WiFi.h>
+#include "Hal.h"
+#include "HeapStats.h"
+#include "TaskRunner.h"
+#include "WebServerSetup.h"
+
+namespace {
+  TelemetrySample s_ring[TELEMETRY_SAMPLES];
+  uint32_t s_total = 0;
+
+  inline uint16_t sat16(uint64_t v) { return v > 0xFFFF ? 0xFFFF : (uint16_t)v; }
+
+#if TELEMETRY_FLUSH_EVERY > 0
+  // Append to the flash trail, starting a new file once it is full
+  void flush(const TelemetrySample &s) {
+    const char *path = "/telemetry.bin", *old = "/telemetry.old";
+    File f = hal::fs().open(path, "a");
+    if (!f) return;
+    if (f.size() >= TELEMETRY_FILE_MAX) {
+      f.close();
+      hal::fs().remove(old);
+      hal::fs().rename(path, old);
+      f = hal::fs().open(path, "a");
+      if (!f) return;
+    }
+    f.write((const uint8_t *)&s, sizeof(s));
+    f.close();
+  }
+#endif
+}
+
+void Telemetry::sample() {
+  const HeapInfo h = HeapStats::now();
+  const PassWindow w = Tasks::takePasses();
+  TelemetrySample &s = s_ring[s_total % TELEMETRY_SAMPLES];
+  s.uptimeS = hal::millis() / 1000;
+  s.freeBytes = h.freeBytes;
+  s.maxBlock = h.maxBlock;
+  s.fragPct = h.fragPct;
+  s.rssi = (WiFi.status() == WL_CONNECTED) ? (int8_t)WiFi.RSSI() : 0;
+  s.passes = sat16(w.passes);
+  s.loopMinUs = sat16(w.minUs);
+  s.loopAvgUs = sat16(w.passes ? w.totalUs / w.passes : 0);
+  s.loopMaxUs = sat16(w.maxUs);
+  s.wsClients = webWsClients();
+  s.httpOpen = webOpenRequests();
+  s_total++;
+#if TELEMETRY_FLUSH_EVERY > 0
+  if (s_total % TELEMETRY_FLUSH_EVERY == 0) flush(s);
+#endif
+}
+
+uint32_t Telemetry::total() { return s_total; }
+
+uint16_t Telemetry::count() {
+  return s_total < TELEMETRY_SAMPLES ? (uint16_t)s_total : TELEMETRY_SAMPLES;
+}
+
+bool Telemetry::get(uint32_t seq, TelemetrySample &out) {
+  if (seq >= s_total || s_total - seq > TELEMETRY_SAMPLES) return false;
+  out = s_ring[seq % TELEMETRY_SAMPLES];
+  return true;
+}
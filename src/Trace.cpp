@@ -0,0 +1,75 @@
+#include "Trace.h"
+#include "Hal.h"
+
+#if TRACE_ENABLED
+namespace {
+  TraceProbe s_probes[TRACE_MAX_PROBES];
+  uint8_t s_count = 0;
+
+  void clearStats(TraceProbe &p) {
+    const char *name = p.name;
+    p = {};
+    p.name = name;
+    p.minCycles = UINT32_MAX;
+  }
+}
+
+TraceProbe *Trace::add(const char *name) {
+  for (uint8_t i = 0; i < s_count; ++i)
+    if (strcmp(s_probes[i].name, name) == 0) return &s_probes[i];   // same name, several scopes
+  if (s_count >= TRACE_MAX_PROBES) return nullptr;
+  TraceProbe &p = s_probes[s_count++];
+  p.name = name;
+  clearStats(p);
+  return &p;
+}
+
+void Trace::record(TraceProbe *p, uint32_t cycles) {
+  p->count++;
+  p->sumCycles += cycles;
+  if (cycles < p->minCycles) p->minCycles = cycles;
+  if (cycles > p->maxCycles) p->maxCycles = cycles;
+  const uint32_t us = cycles / hal::cpuMHz();
+  uint8_t b = 0;
+  while (b < kTraceBuckets - 1 && (us >> (b + 1))) b++;   // bucket b: us < 2^(b+1)
+  p->hist[b]++;
+}
+
+uint8_t Trace::count() { return s_count; }
+const TraceProbe &Trace::probe(uint8_t i) { return s_probes[i]; }
+
+void Trace::reset() {
+  for (uint8_t i = 0; i < s_count; ++i) clearStats(s_probes[i]);
+}
+
+void Trace::dump(Print &out) {
+  const float mhz = (float)hal::cpuMHz();
+  out.printf("trace: %u probes, us; hist buckets <2,<4,...,<2048,more\n", s_count);
+  for (uint8_t i = 0; i < s_count; ++i) {
+    const TraceProbe &p = s_probes[i];
+    out.printf("%-18s n=%lu min=%.1f avg=%.1f max=%.1f hist=", p.name, (unsigned long)p.count,
+               p.count ? p.minCycles / mhz : 0.0f, p.count ? (float)(p.sumCycles / p.count) / mhz : 0.0f,
+               p.maxCycles / mhz);
+    for (uint8_t b = 0; b < kTraceBuckets; ++b) out.printf(b ? ",%lu" : "%lu", (unsigned long)p.hist[b]);
+    out.println();
+  }
+}
+
+void Trace::loop() {
+  while (Serial.available()) {
+    switch (Serial.read()) {
+      case 't': dump(Serial); break;
+      case 'r': reset(); Serial.println(F("trace: reset")); break;
+      default: break;
+    }
+  }
+}
+
+#else
+// Compiled out: no probe table, just the answers /api/trace still gives
+void Trace::reset() {}
+
+void Trace::dump(Print &out) {
+  out.println(F("trace: compiled out (build with -DTRACE_ENABLED=1)"));
+}
+#endif
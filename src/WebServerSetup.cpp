@@ -16,6 +16,24 @@
 #include "WebServerSetup.h"
 #include "Logger.h"
 #include "LogRoutes.h"
+#include "TaskRunner.h"
+#include "DoseSequencer.h"
+#include "Dosing.h"
+#include "JsonArena.h"
+#include "JsonPool.h"
+#include "HeapStats.h"
+#include "Telemetry.h"
+#include "Trace.h"
+
+// Settings uploads (POST /api/settings, PATCH /api/pumps/N): body limit,
+// and the static buffer holding the body plus its parse arena
+#ifndef SETTINGS_MAX_BODY
+#define SETTINGS_MAX_BODY 3072
+#endif
+#ifndef SETTINGS_UPLOAD_BUF
+#define SETTINGS_UPLOAD_BUF 6144
+#endif
+static_assert(SETTINGS_MAX_BODY + 1024 <= SETTINGS_UPLOAD_BUF, "settings upload buffer leaves no room to parse");
 
 
 // Adjust as you like
@@ -24,9 +42,11 @@ static AsyncWebServer server(80);
 
 //AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
+static uint32_t s_rebootAtMs = 0;   // non-zero: restart pending
+static uint8_t s_httpOpen = 0;      // requests between routing and disconnect
 
-static String statusJson() {
-  JsonDocument doc;
+static void buildStatus(JsonDocument &doc) {
+  TRACE_SCOPE("status.build");
   doc["uptime_ms"] = millis();
 
   JsonArray parr = doc["pumps"].to<JsonArray>();
@@ -39,27 +59,513 @@ static String statusJson() {
     o["start_ms"] = s.startMs;
     o["dur_ms"] = s.durMs;
     o["delivered_ml"] = s.deliveredML;
+    o["overshoot_ms"] = s.overshootUs / 1000.0f;
+    o["pending_ml"] = sequencer.pendingMl(i);
     o["ml_per_sec"] = settings.pump[i].mlPerSec;
     o["duty"] = settings.pump[i].duty;
     uint32_t due = scheduler.nextRunSec(i);
     o["next_run_s"] = (due == UINT32_MAX) ? -1 : (int32_t)due;
   }
 
-  String out; serializeJson(doc, out);
-  return out;
+  LogQueueStats lq = Logger::queueStats();
+  JsonObject lo = doc["log"].to<JsonObject>();
+  lo["queue"] = lq.depth;
+  lo["dropped"] = lq.dropped;
+  lo["flushes"] = lq.flushes;
+  lo["flush_us"] = lq.lastFlushUs;
+  lo["flush_max_us"] = lq.maxFlushUs;
 }
 
+// Answer with a lease's document. The lease rides along with the response
+// until its last byte is out, then goes back to the pool.
+static void sendLease(AsyncWebServerRequest *req, std::shared_ptr<JsonLease> l) {
+  const size_t len = l->serialize();
+  auto *res = req->beginResponse("application/json", len, [l](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+    size_t n = min(maxLen, l->outLen() - index);
+    memcpy(buf, l->out() + index, n);
+    return n;
+  });
+  req->send(res);
+}
+
+// Full status snapshot to one client, or to all of them
+static void wsSendStatus(AsyncWebSocketClient *client) {
+  JsonLease l;
+  buildStatus(l.doc());
+  l.serialize();
+  if (client) client->text(l.out(), l.outLen());
+  else ws.textAll(l.out(), l.outLen());
+}
+
+// ---- Static assets: gzip + ETag ----
+// scripts/compress_assets.py stores <file>.gz next to each page. The ETag
+// comes from the gzip trailer (CRC32 + size of the original), so it changes
+// exactly when the content does; it is read once per file per boot. The
+// gzip body is a different representation, so it gets its own tag ("-gz")
+// and both carry Vary: Accept-Encoding.
+struct AssetTag {
+  const char* path;
+  bool gz;
+  char etag[24];     // identity body
+  char etagGz[24];   // gzip body
+};
+static AssetTag s_assetTags[4];
+static uint8_t s_assetTagCount = 0;
+
+static const AssetTag& assetTag(const char* path) {
+  for (uint8_t i = 0; i < s_assetTagCount; ++i) {
+    if (strcmp(s_assetTags[i].path, path) == 0) return s_assetTags[i];
+  }
+  AssetTag& t = s_assetTags[s_assetTagCount < 4 ? s_assetTagCount++ : 3];
+  t.path = path;
+  t.etag[0] = t.etagGz[0] = 0;
+  String gzPath = String(path) + ".gz";
+  File f = LittleFS.open(gzPath, "r");
+  t.gz = (bool)f;
+  if (f) {
+    uint32_t trailer[2] = {0, 0};   // CRC32, ISIZE (little endian, like the CPU)
+    if (f.size() >= 18 && f.seek(f.size() - 8, SeekSet)) f.read(reinterpret_cast<uint8_t*>(trailer), 8);
+    snprintf(t.etag, sizeof(t.etag), "\"%08lx-%lx\"", (unsigned long)trailer[0], (unsigned long)trailer[1]);
+    snprintf(t.etagGz, sizeof(t.etagGz), "\"%08lx-%lx-gz\"", (unsigned long)trailer[0], (unsigned long)trailer[1]);
+    f.close();
+  } else if ((f = LittleFS.open(path, "r"))) {
+    uint32_t h = 2166136261u;        // no .gz: FNV-1a over the plain file
+    uint8_t buf[256];
+    size_t n;
+    while ((n = f.read(buf, sizeof(buf))) > 0) {
+      for (size_t i = 0; i < n; ++i) { h ^= buf[i]; h *= 16777619u; }
+    }
+    snprintf(t.etag, sizeof(t.etag), "\"%08lx-%lx\"", (unsigned long)h, (unsigned long)f.size());
+    f.close();
+  }
+  return t;
+}
+
+static void sendAsset(AsyncWebServerRequest *req, const char* path, const char* contentType) {
+  const AssetTag& t = assetTag(path);
+  bool gz = t.gz && req->hasHeader("Accept-Encoding") && req->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0;
+  const char* etag = gz ? t.etagGz : t.etag;
+  if (etag[0] && req->hasHeader("If-None-Match") && req->getHeader("If-None-Match")->value() == etag) {
+    auto* res = req->beginResponse(304);
+    res->addHeader("ETag", etag);
+    if (t.gz) res->addHeader("Vary", "Accept-Encoding");
+    res->addHeader("Cache-Control", "no-cache");
+    req->send(res);
+    return;
+  }
+  auto* res = gz ? req->beginResponse(LittleFS, String(path) + ".gz", contentType)
+                 : req->beginResponse(LittleFS, path, contentType);
+  if (gz) res->addHeader("Content-Encoding", "gzip");
+  if (t.gz) res->addHeader("Vary", "Accept-Encoding");
+  if (etag[0]) res->addHeader("ETag", etag);
+  res->addHeader("Cache-Control", "no-cache");   // revalidate with If-None-Match
+  req->send(res);
+}
+
+// ---- Diagnostics: task timing and JSON pool use ----
+// Per-task run time and lateness from the main-loop task runner
+static void buildPerf(JsonDocument &doc) {
+  doc["uptime_ms"] = millis();
+  doc["idle_us"] = Tasks::idleUs();
+
+  JsonArray arr = doc["tasks"].to<JsonArray>();
+  for (uint8_t i = 0; i < Tasks::count(); ++i) {
+    const TaskInfo &t = Tasks::info(i);
+    JsonObject o = arr.add<JsonObject>();
+    o["name"] = t.name;
+    o["period_ms"] = t.periodMs;
+    o["deadline_ms"] = t.deadlineMs;
+    o["runs"] = t.stats.runs;
+    o["last_us"] = t.stats.lastUs;
+    o["max_us"] = t.stats.maxUs;
+    o["total_us"] = t.stats.totalUs;
+    o["avg_us"] = t.stats.runs ? (uint32_t)(t.stats.totalUs / t.stats.runs) : 0;
+    o["late_max_ms"] = t.stats.lateMaxMs;
+    o["late_avg_ms"] = t.stats.runs ? (float)t.stats.lateTotalMs / t.stats.runs : 0.0f;
+    o["missed"] = t.stats.missed;
+  }
+}
+
+// Telemetry ring as a chunked response, one sample per piece: compact JSON
+// ({"cols":[...],"rows":[[...],...]}) or the raw 24-byte samples behind a
+// small header. Samples taken while it is being sent are left out.
+struct __attribute__((packed)) TelemetryHdr {
+  char magic[4];          // "TLM1"
+  uint8_t version;        // kTelemetryVersion
+  uint8_t sampleSize;
+  uint16_t count;
+  uint32_t periodMs;
+};
+
+struct TelemetryStream {
+  bool bin;
+  uint8_t phase = 0;      // 0 header, 1 samples, 2 trailer, 3 done
+  uint32_t seq, end;      // sample numbers still to send: [seq, end)
+  uint32_t rows = 0;
+  char line[160];
+  uint16_t lineLen = 0, lineOff = 0;
+
+  explicit TelemetryStream(bool binary) : bin(binary) {
+    end = Telemetry::total();
+    seq = end - Telemetry::count();
+  }
+
+  bool produce() {
+    lineOff = lineLen = 0;
+    switch (phase) {
+      case 0:
+        phase = 1;
+        if (bin) {
+          const TelemetryHdr h = { { 'T', 'L', 'M', '1' }, kTelemetryVersion, sizeof(TelemetrySample),
+                                   (uint16_t)(end - seq), TELEMETRY_PERIOD_MS };
+          memcpy(line, &h, sizeof(h));
+          lineLen = sizeof(h);
+        } else {
+          lineLen = snprintf(line, sizeof(line), "{\"period_ms\":%u,\"cols\":[\"uptime_s\",\"free\",\"max_block\",\"frag_pct\","
+                             "\"rssi\",\"passes\",\"loop_min_us\",\"loop_avg_us\",\"loop_max_us\",\"ws\",\"http\"],\"rows\":[",
+                             (unsigned)TELEMETRY_PERIOD_MS);
+        }
+        return true;
+      case 1: {
+        TelemetrySample t;
+        while (seq < end) {
+          if (!Telemetry::get(seq++, t)) continue;   // overwritten meanwhile
+          if (bin) {
+            memcpy(line, &t, sizeof(t));
+            lineLen = sizeof(t);
+          } else {
+            lineLen = snprintf(line, sizeof(line), "%s[%lu,%lu,%lu,%u,%d,%u,%u,%u,%u,%u,%u]", rows ? "," : "",
+                               (unsigned long)t.uptimeS, (unsigned long)t.freeBytes, (unsigned long)t.maxBlock,
+                               t.fragPct, t.rssi, t.passes, t.loopMinUs, t.loopAvgUs, t.loopMaxUs,
+                               t.wsClients, t.httpOpen);
+          }
+          rows++;
+          return true;
+        }
+        phase = 2;
+      } // fall through
+      case 2:
+        phase = 3;
+        if (bin) return false;
+        lineLen = strlcpy(line, "]}\n", sizeof(line));
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // AwsResponseFiller body: returning 0 ends the response
+  size_t fill(uint8_t *buf, size_t maxLen) {
+    size_t out = 0;
+    while (out < maxLen) {
+      if (lineOff >= lineLen && !produce()) break;
+      size_t n = min<size_t>(lineLen - lineOff, maxLen - out);
+      memcpy(buf + out, line + lineOff, n);
+      lineOff += n;
+      out += n;
+    }
+    return out;
+  }
+};
+
+// Heap now, its worst since boot, and how the JSON pool is doing
+static void buildHeap(JsonDocument &doc) {
+  const HeapInfo h = HeapStats::now(), w = HeapStats::worst();
+  doc["uptime_ms"] = millis();
+  doc["free"] = h.freeBytes;
+  doc["max_block"] = h.maxBlock;
+  doc["frag_pct"] = h.fragPct;
+  JsonObject lo = doc["worst"].to<JsonObject>();
+  lo["free"] = w.freeBytes;
+  lo["max_block"] = w.maxBlock;
+  lo["frag_pct"] = w.fragPct;
+  lo["samples"] = HeapStats::samples();
+
+  const JsonPoolStats ps = JsonPool::stats();
+  JsonObject po = doc["json_pool"].to<JsonObject>();
+  po["slots"] = JSON_POOL_SLOTS;
+  po["in_use"] = ps.inUse;
+  po["in_use_max"] = ps.inUseMax;
+  po["leases"] = ps.leases;
+  po["misses"] = ps.misses;
+  po["spills"] = ps.spills;
+  po["arena_peak"] = ps.arenaPeak;
+  po["arena_size"] = JSON_POOL_ARENA;
+  po["out_peak"] = ps.outPeak;
+  po["out_size"] = JSON_POOL_OUT;
+}
+
+// ---- WebSocket status: full snapshot on connect, deltas afterwards ----
+// What clients were last told, per pump. The next-run countdown is kept as
+// its target time, so an idle device sends nothing at all.
+struct PumpSnap {
+  bool running, reverse;
+  uint32_t startMs, durMs;
+  int32_t deliveredDl;   // 0.1 ml steps
+  int32_t overshootUs;
+  int32_t nextAt;        // uptime second of the next run, -1 = none
+  float mlPerSec;
+  uint8_t duty;
+};
+static PumpSnap s_sent[NUM_PUMPS];
+
+static void snapPump(uint8_t i, PumpSnap &p) {
+  const auto &s = pumpCtl.state(i);
+  p.running = s.running;
+  p.reverse = s.reverse;
+  p.startMs = s.startMs;
+  p.durMs = s.durMs;
+  p.deliveredDl = (int32_t)lroundf(s.deliveredML * 10.0f);
+  p.overshootUs = s.overshootUs;
+  uint32_t due = scheduler.nextRunSec(i);
+  p.nextAt = (due == UINT32_MAX) ? -1 : (int32_t)(millis() / 1000 + due);
+  p.mlPerSec = settings.pump[i].mlPerSec;
+  p.duty = settings.pump[i].duty;
+}
+
+static void markAllSent() {
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) snapPump(i, s_sent[i]);
+}
+
+// Send only the fields that changed since the last push; nothing is built
+// when no client is connected or nothing changed.
 static void wsBroadcastStatus() {
-  String s = statusJson();
-  ws.textAll(s);
+  if (!ws.count()) return;
+
+  char buf[512];
+  size_t n = 0;
+  auto add = [&](const char *fmt, auto... args) {
+    if (n < sizeof(buf)) n += snprintf(buf + n, sizeof(buf) - n, fmt, args...);
+  };
+  const uint32_t now = millis();
+  add("{\"type\":\"delta\",\"uptime_ms\":%lu,\"pumps\":[", (unsigned long)now);
+  bool anyPump = false;
+
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+    PumpSnap cur;
+    snapPump(i, cur);
+    PumpSnap &old = s_sent[i];
+    bool nextMoved = (cur.nextAt < 0) != (old.nextAt < 0) || abs(cur.nextAt - old.nextAt) > 1;   // ignore 1 s rounding jitter
+    if (cur.running == old.running && cur.reverse == old.reverse && cur.startMs == old.startMs &&
+        cur.durMs == old.durMs && cur.deliveredDl == old.deliveredDl && cur.overshootUs == old.overshootUs && !nextMoved &&
+        cur.mlPerSec == old.mlPerSec && cur.duty == old.duty) continue;
+
+    add("%s{\"idx\":%u", anyPump ? "," : "", i);
+    if (cur.running != old.running)         add(",\"running\":%s", cur.running ? "true" : "false");
+    if (cur.reverse != old.reverse)         add(",\"reverse\":%s", cur.reverse ? "true" : "false");
+    if (cur.startMs != old.startMs)         add(",\"start_ms\":%lu", (unsigned long)cur.startMs);
+    if (cur.durMs != old.durMs)             add(",\"dur_ms\":%lu", (unsigned long)cur.durMs);
+    if (cur.deliveredDl != old.deliveredDl) add(",\"delivered_ml\":%.1f", cur.deliveredDl / 10.0f);
+    if (cur.overshootUs != old.overshootUs) add(",\"overshoot_ms\":%.3f", cur.overshootUs / 1000.0f);
+    if (nextMoved)                          add(",\"next_run_s\":%ld", cur.nextAt < 0 ? -1L : (long)(cur.nextAt - (int32_t)(now / 1000)));
+    if (cur.mlPerSec != old.mlPerSec)       add(",\"ml_per_sec\":%.3f", cur.mlPerSec);
+    if (cur.duty != old.duty)               add(",\"duty\":%u", cur.duty);
+    add("}");
+    anyPump = true;
+    int32_t keepNext = old.nextAt;
+    old = cur;
+    if (!nextMoved) old.nextAt = keepNext;
+  }
+  if (!anyPump) return;
+  add("]}");
+  if (n >= sizeof(buf)) { markAllSent(); wsSendStatus(nullptr); return; }   // did not fit: full snapshot
+  ws.textAll(buf, n);
+}
+
+// ---- Pump commands, shared by the HTTP routes and the WebSocket channel ----
+enum class PumpCmd : uint8_t { Run, Prime, Purge, Stop, Dose };
+static constexpr long kMaxRunSec = 3600;
+static constexpr float kMaxDoseMl = 1000.0f;
+
+static bool parsePumpCmd(const char *name, PumpCmd &out) {
+  static const char *const kNames[] = { "run", "prime", "purge", "stop", "dose" };
+  for (uint8_t i = 0; i < 5; ++i) {
+    if (strcmp(name, kNames[i]) == 0) { out = (PumpCmd)i; return true; }
+  }
+  return false;
+}
+
+// args: {"idx":N, "sec":S}; sec defaults as the buttons always did.
+// dose takes {"idx":N, "ml":V} instead.
+static bool pumpCommand(PumpCmd cmd, JsonVariantConst args, const char *&err) {
+  if (!args["idx"].is<long>()) { err = "missing idx"; return false; }   // never default to pump 0
+  long idx = args["idx"].as<long>();
+  if (idx < 0 || idx >= NUM_PUMPS) { err = "bad idx"; return false; }
+  if (cmd == PumpCmd::Dose) {
+    float ml = args["ml"] | 0.0f;
+    if (!(ml > 0.0f && ml <= kMaxDoseMl)) { err = "bad ml"; return false; }
+    if (!planDose(settings.pump[idx], ml).totalMs()) { err = "no flow at duty"; return false; }
+    sequencer.enqueue(idx, ml);   // starts when the power budget allows
+    return true;
+  }
+  long defSec = (cmd == PumpCmd::Run) ? settings.pump[idx].defaultRunSec : (cmd == PumpCmd::Prime) ? 3 : 2;
+  long sec = args["sec"] | defSec;
+  if (cmd != PumpCmd::Stop && (sec < 1 || sec > kMaxRunSec)) { err = "bad sec"; return false; }
+
+  // Hands-on controls start at once, outside the sequencer's limits
+  switch (cmd) {
+    case PumpCmd::Run:   pumpCtl.run(idx, sec);   break;
+    case PumpCmd::Prime: pumpCtl.prime(idx, sec); break;
+    case PumpCmd::Purge: pumpCtl.purge(idx, sec); break;
+    case PumpCmd::Stop:  pumpCtl.stop(idx);       break;
+    case PumpCmd::Dose:  break;
+  }
+  return true;
+}
+
+static void sendError(AsyncWebServerRequest *req, int code, const char *err) {
+  req->send(code, "application/json", String("{\"ok\":false,\"err\":\"") + err + "\"}");
+}
+
+// A body that is missing, split across chunks, truncated or not JSON is
+// refused with 400 instead of reaching pumpCommand() as an empty document
+static void onPumpCommand(AsyncWebServer &server, const char *path, PumpCmd cmd) {
+  server.on(path, HTTP_POST,
+    [](AsyncWebServerRequest *req){
+      if (req->contentLength() == 0) sendError(req, 400, "empty body");
+    },
+    NULL,
+    [cmd](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (index != 0 || len != total) {   // command bodies are tens of bytes: one chunk unless cut short
+        if (index == 0) sendError(req, 400, "incomplete body");
+        return;
+      }
+      JsonLease l;
+      if (deserializeJson(l.doc(), data, len)) { sendError(req, 400, "bad json"); return; }
+      const char *err = nullptr;
+      if (!pumpCommand(cmd, l.doc().as<JsonVariantConst>(), err)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"ok\":false,\"err\":\"%s\"}", err);
+        req->send(400, "application/json", msg);
+        return;
+      }
+      req->send(200, "application/json", "{\"ok\":true}");
+      wsBroadcastStatus();
+    });
+}
+
+// ---- Settings uploads ----
+// The body is copied into s_upload and parsed into an arena on the rest of
+// that buffer, so an upload never touches the heap and costs the same RAM
+// however many pumps, points or slots it carries. Bodies over
+// SETTINGS_MAX_BODY get 413 on their first chunk and the rest is dropped;
+// one upload at a time.
+typedef std::function<bool(JsonVariantConst body, String &err)> SettingsApply;
+
+static struct {
+  AsyncWebServerRequest *owner = nullptr;   // request filling buf
+  alignas(4) uint8_t buf[SETTINGS_UPLOAD_BUF];
+} s_upload;
+
+static void onSettingsBody(AsyncWebServer &server, const char *path, WebRequestMethod method, SettingsApply apply) {
+  server.on(path, method,
+    // onRequest runs after the body; it only has to answer a request that had none
+    [](AsyncWebServerRequest *req){
+      if (req->contentLength() == 0) sendError(req, 400, "empty body");
+    },
+    nullptr,
+    [apply](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (index == 0) {
+        if (total > SETTINGS_MAX_BODY) { sendError(req, 413, "body too large"); return; }
+        if (s_upload.owner) { sendError(req, 409, "another upload in progress"); return; }
+        s_upload.owner = req;
+        req->onDisconnect([req]{ if (s_upload.owner == req) s_upload.owner = nullptr; });
+      }
+      if (s_upload.owner != req) return;   // refused above
+      memcpy(s_upload.buf + index, data, len);
+      if (index + len < total) return;
+
+      String err;
+      bool ok = false, tooBig = false;
+      {
+        const size_t used = (total + 3) & ~size_t(3);
+        JsonArena arena(s_upload.buf + used, sizeof(s_upload.buf) - used);
+        JsonDocument doc(&arena);
+        DeserializationError e = deserializeJson(doc, (const char *)s_upload.buf, total);
+        if (e == DeserializationError::NoMemory) tooBig = true;
+        else if (e) err = e.c_str();
+        else ok = apply(doc.as<JsonVariantConst>(), err);
+      }
+      s_upload.owner = nullptr;
+
+      if (ok) {
+        wsBroadcastStatus();
+        req->send(200, "application/json", "{\"ok\":true}");
+      } else if (tooBig) {
+        sendError(req, 413, "body too complex");
+      } else {
+        sendError(req, 400, err.length() ? err.c_str() : "save failed");
+      }
+    });
+}
+
+// WebSocket commands: {"id":7,"cmd":"run","idx":0,"sec":5}
+//                     {"id":8,"cmd":"settings","data":{...same body as POST /api/settings...}}
+//                     {"id":9,"cmd":"pump","idx":1,"data":{...same body as PATCH /api/pumps/1...}}
+// Every message is answered with {"type":"ack","id":7,"ok":true|false[,"err":"..."]}.
+// Commands are parsed in a pooled arena; a full settings document may not
+// fit there, POST /api/settings takes those.
+static void wsHandleCommand(AsyncWebSocketClient *client, const uint8_t *data, size_t len) {
+  JsonLease l;
+  JsonDocument &doc = l.doc();
+  char errBuf[48] = "";
+  const char *err = nullptr;
+  long id = -1;
+  bool ok = false;
+
+  DeserializationError de = deserializeJson(doc, data, len);
+  if (de == DeserializationError::NoMemory) {
+    err = "too large, use POST /api/settings";
+  } else if (de) {
+    err = "bad json";
+  } else {
+    id = doc["id"] | -1L;
+    const char *name = doc["cmd"] | "";
+    PumpCmd cmd;
+    if (parsePumpCmd(name, cmd)) {
+      ok = pumpCommand(cmd, doc.as<JsonVariantConst>(), err);
+    } else if (strcmp(name, "settings") == 0) {
+      String e;
+      ok = settingsFromJson(doc["data"].as<JsonVariantConst>(), e) && settingsSave();
+      if (ok) scheduler.invalidate();   // times/doses may have changed
+      else { strlcpy(errBuf, e.length() ? e.c_str() : "save failed", sizeof(errBuf)); err = errBuf; }
+    } else if (strcmp(name, "pump") == 0) {
+      String e;
+      PumpConfig pc;
+      const long idx = doc["idx"].is<long>() ? doc["idx"].as<long>() : -1;   // never default to pump 0
+      if (idx < 0 || idx >= NUM_PUMPS) {
+        err = "bad idx";
+      } else {
+        ok = pumpPatchFromJson(idx, doc["data"].as<JsonVariantConst>(), pc, e) && settingsSavePump(idx, pc);
+        if (ok) scheduler.invalidate(idx);
+        else { strlcpy(errBuf, e.length() ? e.c_str() : "save failed", sizeof(errBuf)); err = errBuf; }
+      }
+    } else {
+      err = "unknown cmd";
+    }
+  }
+
+  char ack[96];
+  if (ok) snprintf(ack, sizeof(ack), "{\"type\":\"ack\",\"id\":%ld,\"ok\":true}", id);
+  else    snprintf(ack, sizeof(ack), "{\"type\":\"ack\",\"id\":%ld,\"ok\":false,\"err\":\"%s\"}", id, err);
+  client->text(ack);
+  if (ok) wsBroadcastStatus();
 }
 
 static void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
                       AwsEventType type, void *arg, uint8_t *data, size_t len) {
   if (type == WS_EVT_CONNECT) {
-    client->text(statusJson());
+    // s_sent is the baseline of every client: push what changed since the
+    // last delta to the ones already connected before moving it
+    wsBroadcastStatus();
+    markAllSent();
+    wsSendStatus(client);   // full snapshot, deltas follow
   } else if (type == WS_EVT_DATA) {
-    // optional: parse small commands if you want
+    // commands are small: only whole, single-frame text messages up to SETTINGS_MAX_BODY are accepted
+    auto *info = static_cast<AwsFrameInfo *>(arg);
+    if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT && len <= SETTINGS_MAX_BODY) {
+      wsHandleCommand(client, data, len);
+    }
   }
 }
 
@@ -68,6 +574,14 @@ void webserverBegin() {
   if (!LittleFS.begin()) {
     Serial.println(F("LittleFS mount failed!"));
   }
+  // Open-request count for telemetry. This replaces any disconnect callback
+  // a body handler set; the settings upload's only matters while the body
+  // is still arriving, which is before this runs.
+  server.addMiddleware([](AsyncWebServerRequest *req, ArMiddlewareNext next){
+    s_httpOpen++;
+    req->onDisconnect([]{ if (s_httpOpen) s_httpOpen--; });
+    next();
+  });
   ws.onEvent(onWsEvent);
   server.addHandler(&ws);
 
@@ -76,14 +590,57 @@ void webserverBegin() {
 
   // Static files from LittleFS
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *req){
-    req->send(LittleFS, "/index.html", "text/html");
+    sendAsset(req, "/index.html", "text/html");
   });
     server.on("/log_control", HTTP_GET, [](AsyncWebServerRequest *req){
-    req->send(LittleFS, "/doserlog.html", "text/html");
+    sendAsset(req, "/doserlog.html", "text/html");
   });
 
   server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *req){
-    req->send(200, "application/json", statusJson());
+    auto l = std::make_shared<JsonLease>();
+    buildStatus(l->doc());
+    sendLease(req, l);
+  });
+
+  // Free heap, largest block and fragmentation, now and worst since boot,
+  // plus the JSON pool's high-water marks
+  server.on("/api/heap", HTTP_GET, [](AsyncWebServerRequest *req){
+    HeapStats::sample();
+    auto l = std::make_shared<JsonLease>();
+    buildHeap(l->doc());
+    sendLease(req, l);
+  });
+
+  // Main-loop budget per task; POST resets the counters.
+  // ?series=json|bin returns the telemetry ring instead.
+  server.on("/api/perf", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (req->hasParam("series")) {
+      const bool bin = req->getParam("series")->value() == "bin";
+      auto st = std::make_shared<TelemetryStream>(bin);
+      auto *res = req->beginChunkedResponse(bin ? "application/octet-stream" : "application/json",
+        [st](uint8_t *buf, size_t maxLen, size_t) -> size_t { return st->fill(buf, maxLen); });
+      res->addHeader("Cache-Control", "no-store");
+      req->send(res);
+      return;
+    }
+    auto l = std::make_shared<JsonLease>();
+    buildPerf(l->doc());
+    sendLease(req, l);
+  });
+  // Hot-path probes (builds with -DTRACE_ENABLED=1); POST resets them
+  server.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest *req){
+    AsyncResponseStream *res = req->beginResponseStream("text/plain; charset=utf-8");
+    Trace::dump(*res);
+    res->addHeader("Cache-Control", "no-store");
+    req->send(res);
+  });
+  server.on("/api/trace", HTTP_POST, [](AsyncWebServerRequest *req){
+    Trace::reset();
+    req->send(200, "application/json", "{\"ok\":true}");
+  });
+  server.on("/api/perf", HTTP_POST, [](AsyncWebServerRequest *req){
+    Tasks::resetStats();
+    req->send(200, "application/json", "{\"ok\":true}");
   });
 
   server.on("/api/settings", HTTP_GET, [](AsyncWebServerRequest *req){
@@ -136,84 +693,32 @@ void webserverBegin() {
 ); */
 
 
-server.on("/api/settings", HTTP_POST,
-  // onRequest: we’ll send the response from the body handler; keep this empty.
-  [](AsyncWebServerRequest* req){},
-  // onUpload (file upload): not used
-  nullptr,
-  // onBody: called for each chunk of the request body
-  [](AsyncWebServerRequest* req, uint8_t* data, size_t len, size_t index, size_t total){
-    // First chunk: allocate a per-request buffer
-    if (index == 0) {
-      auto* buf = new String();
-      if (total > 0) buf->reserve(total);     // reserve if Content-Length is known
-      req->_tempObject = buf;                 // stash it on the request
-    }
-
-    // Append this chunk
-    auto* buf = static_cast<String*>(req->_tempObject);
-    buf->concat(reinterpret_cast<const char*>(data), len);
-
-    // Last chunk? Parse, apply, save, respond, clean up
-    if (index + len == total) {
-      String err;
-      bool ok = settingsFromJson(*buf, err) && settingsSave();
-
-      // cleanup buffer before responding
-      delete buf;
-      req->_tempObject = nullptr;
-
-      if (ok) {
-        wsBroadcastStatus();  // if you want clients to refresh
-        req->send(200, "application/json", "{\"ok\":true}");
-      } else {
-        String m = String("{\"ok\":false,\"err\":\"") + err + "\"}";
-        req->send(400, "application/json", m);
-      }
-    }
-  }
-);
-
+  // Full settings document (same shape as GET /api/settings)
+  onSettingsBody(server, "/api/settings", HTTP_POST, [](JsonVariantConst body, String &err){
+    if (!settingsFromJson(body, err) || !settingsSave()) return false;
+    scheduler.invalidate();   // rebuild the dose timeline from the new settings
+    return true;
+  });
 
-  // Controls
-  server.on("/api/run", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      JsonDocument doc; deserializeJson(doc, data, len);
-      uint8_t idx = doc["idx"] | 0;
-      uint16_t sec = doc["sec"] | settings.pump[idx].defaultRunSec;
-      pumpCtl.run(idx, sec);
-      req->send(200, "application/json", "{\"ok\":true}");
-      wsBroadcastStatus();
+  // PATCH /api/pumps/N: JSON Merge Patch of one pump, e.g. {"times":[{"sec":28800,"ml":2}]}.
+  // Saves only that pump's section and re-plans only its slots.
+  for (uint8_t i = 0; i < NUM_PUMPS; ++i) {
+    char path[20];
+    snprintf(path, sizeof(path), "/api/pumps/%u", i);
+    onSettingsBody(server, path, HTTP_PATCH, [i](JsonVariantConst body, String &err){
+      PumpConfig pc;
+      if (!pumpPatchFromJson(i, body, pc, err) || !settingsSavePump(i, pc)) return false;
+      scheduler.invalidate(i);
+      return true;
     });
+  }
 
-  server.on("/api/prime", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      JsonDocument doc; deserializeJson(doc, data, len);
-      uint8_t idx = doc["idx"] | 0;
-      uint16_t sec = doc["sec"] | 3;
-      pumpCtl.prime(idx, sec);
-      req->send(200, "application/json", "{\"ok\":true}");
-      wsBroadcastStatus();
-    });
-
-  server.on("/api/purge", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      JsonDocument doc; deserializeJson(doc, data, len);
-      uint8_t idx = doc["idx"] | 0;
-      uint16_t sec = doc["sec"] | 2;
-      pumpCtl.purge(idx, sec);
-      req->send(200, "application/json", "{\"ok\":true}");
-      wsBroadcastStatus();
-    });
-
-  server.on("/api/stop", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      JsonDocument doc; deserializeJson(doc, data, len);
-      uint8_t idx = doc["idx"] | 0;
-      pumpCtl.stop(idx);
-      req->send(200, "application/json", "{\"ok\":true}");
-      wsBroadcastStatus();
-    });
+  // Controls (same handlers as the WebSocket "cmd" messages)
+  onPumpCommand(server, "/api/run",   PumpCmd::Run);
+  onPumpCommand(server, "/api/prime", PumpCmd::Prime);
+  onPumpCommand(server, "/api/purge", PumpCmd::Purge);
+  onPumpCommand(server, "/api/stop",  PumpCmd::Stop);
+  onPumpCommand(server, "/api/dose",  PumpCmd::Dose);
 
 
 
@@ -221,20 +726,15 @@ server.on("/api/settings", HTTP_POST,
 
 // Full CSV download
 server.on("/logs.csv", HTTP_GET, [](AsyncWebServerRequest* req){
-  Logger::begin();  // ensure header exists
   if (!Logger::exists()) {
     req->send(404, "text/plain; charset=utf-8", "no logs");
     return;
   }
-  auto* res = req->beginResponse(LittleFS, "/logs.csv", "text/csv; charset=utf-8");
-  res->addHeader("Cache-Control", "no-store");
-  // res->addHeader("Content-Disposition","attachment; filename=\"logs.csv\"");
-  req->send(res);
+  sendLogCsv(req, false);
 });
 
-// Tail last N lines (text)
+// Tail last N lines (text), streamed like the other log views
 server.on("/api/logs/tail", HTTP_GET, [](AsyncWebServerRequest* req){
-  Logger::begin();
   size_t n = 200;
   if (req->hasParam("n")) {
     int v = req->getParam("n")->value().toInt();
@@ -242,11 +742,13 @@ server.on("/api/logs/tail", HTTP_GET, [](AsyncWebServerRequest* req){
     if (v > 2000) v = 2000;
     n = (size_t)v;
   }
-  String txt = Logger::tail(n);
-  if (!txt.length()) txt = F("no logs");
-  auto* res = req->beginResponse(200, "text/plain; charset=utf-8", txt);
-  res->addHeader("Cache-Control", "no-store");
-  req->send(res);
+  if (!Logger::exists()) {
+    req->send(200, "text/plain; charset=utf-8", "no logs");
+    return;
+  }
+  LogQuery q = parseLogQuery(req);   // optional pump/event/from/to filters
+  q.last = n;
+  sendLogCsv(req, false, q);
 });
 
 // Clear logs
@@ -258,14 +760,32 @@ server.on("/api/logs/clear", HTTP_GET, [](AsyncWebServerRequest* req){
   });
 
 
-  // OTA
+// Reboot: done from webserverLoop() so the queued log records are flushed first
+server.on("/api/reboot", HTTP_POST, [](AsyncWebServerRequest* req){
+    s_rebootAtMs = millis() + 500;   // let the response go out
+    req->send(200, "application/json", "{\"ok\":true}");
+  });
+
+  // OTA (flush the log with Logger::flush() before the update starts)
  // AsyncElegantOTA.begin(&server);
 
   server.begin();
   logInfo("HTTP server started");
 }
 
+uint8_t webWsClients() {
+  return (uint8_t)min<size_t>(ws.count(), 255);
+}
+
+uint8_t webOpenRequests() {
+  return s_httpOpen;
+}
+
 void webserverLoop() {
+  if (s_rebootAtMs && (int32_t)(millis() - s_rebootAtMs) >= 0) {
+    Logger::flush();
+    ESP.restart();
+  }
   static uint32_t lastPush = 0;
   if (millis() - lastPush > 1000) {
     lastPush = millis();
@@ -0,0 +1,290 @@
+// Host stand-ins behind Hal.h, built only by [env:native] (see the
+// build_src_filter there). Nothing here runs on the device.
+#include "Hal.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+  uint64_t s_upUs = 0;        // "since boot"
+  uint64_t s_wallUs = 0;      // epoch microseconds; < 100000 s means never synced
+  uint8_t s_pwm[16] = {};
+  bool s_pin[64] = {};
+  uint32_t s_pwmWrites = 0;
+  hal::host::PwmHook s_pwmHook = nullptr;
+  void *s_pwmCtx = nullptr;
+  hal::host::FsStats s_fsStats = {};
+  uint64_t s_writeBudget = UINT64_MAX;   // bytes writes may still put out
+  std::string s_root;
+  bool s_quiet = false;
+  hal::FS s_fs;
+
+  const std::string &rootDir() {
+    if (s_root.empty()) {
+      const char *tmp = getenv("TMPDIR");
+      std::string tmpl = std::string(tmp && *tmp ? tmp : "/tmp") + "/doser-fs-XXXXXX";
+      std::vector<char> buf(tmpl.begin(), tmpl.end());
+      buf.push_back(0);
+      if (!mkdtemp(buf.data())) { perror("mkdtemp"); abort(); }
+      s_root = buf.data();
+    }
+    return s_root;
+  }
+
+  std::string hostPath(const char *path) {
+    return rootDir() + (path[0] == '/' ? "" : "/") + path;
+  }
+
+  void removeTree(const std::string &dir, bool self) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    while (struct dirent *e = readdir(d)) {
+      if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+      std::string p = dir + "/" + e->d_name;
+      struct stat st;
+      if (stat(p.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) removeTree(p, true);
+      else unlink(p.c_str());
+    }
+    closedir(d);
+    if (self) ::rmdir(dir.c_str());
+  }
+}
+
+namespace hal {
+  // Every Timer ever constructed; advanceUs() scans for the earliest armed one
+  struct TimerList {
+    static std::vector<Timer *> &all() { static std::vector<Timer *> v; return v; }
+
+    static Timer *earliest(uint64_t upToUs) {
+      Timer *best = nullptr;
+      for (Timer *t : all())
+        if (t->_armed && t->_dueUs <= upToUs && (!best || t->_dueUs < best->_dueUs)) best = t;
+      return best;
+    }
+
+    static void fire(Timer *t) {
+      t->_armed = false;
+      std::function<void()> fn = t->_fn;   // the callback may re-arm its own timer
+      fn();
+    }
+
+    static uint64_t nextDue() {
+      uint64_t due = UINT64_MAX;
+      for (Timer *t : all()) if (t->_armed && t->_dueUs < due) due = t->_dueUs;
+      return due;
+    }
+
+    static void disarmAll() { for (Timer *t : all()) t->_armed = false; }
+    static uint64_t due(const Timer *t) { return t->_dueUs; }
+  };
+
+  Timer::Timer() { TimerList::all().push_back(this); }
+
+  Timer::~Timer() {
+    auto &v = TimerList::all();
+    v.erase(std::remove(v.begin(), v.end(), this), v.end());
+  }
+
+  void Timer::arm(uint32_t ms, std::function<void()> fn) {
+    _fn = std::move(fn);
+    _dueUs = s_upUs + ms * 1000ULL;
+    _armed = true;
+  }
+}
+
+// ---- clock ----
+
+uint32_t hal::millis() { return (uint32_t)(s_upUs / 1000); }
+uint32_t hal::micros() { return (uint32_t)s_upUs; }
+time_t hal::now() { return (time_t)(s_wallUs / 1000000); }
+uint32_t hal::cpuMHz() { return 160; }
+uint32_t hal::cycles() { return (uint32_t)(s_upUs * cpuMHz()); }
+void hal::sleepMs(uint32_t ms) { host::advanceMs(ms); }
+void hal::yield() {}
+
+// ---- GPIO / PWM ----
+
+void hal::pinOutput(uint8_t) {}
+void hal::pinWrite(uint8_t pin, bool high) { if (pin < sizeof(s_pin)) s_pin[pin] = high; }
+void hal::pwmSetup(uint8_t, uint8_t, uint32_t) {}
+
+void hal::pwmWrite(uint8_t ch, uint8_t, uint8_t duty) {
+  if (ch >= sizeof(s_pwm)) return;
+  s_pwm[ch] = duty;
+  s_pwmWrites++;
+  if (s_pwmHook) s_pwmHook(s_pwmCtx, ch, duty);
+}
+
+void hal::console(const char *line) {
+  if (!s_quiet) printf("%s\n", line);
+}
+
+hal::FS &hal::fs() { return s_fs; }
+
+// ---- test controls ----
+
+void hal::host::reset() {
+  reboot();
+  s_wallUs = 0;
+  s_pwmWrites = 0;
+  s_pwmHook = nullptr;
+  s_writeBudget = UINT64_MAX;
+}
+
+void hal::host::reboot() {
+  s_upUs = 0;
+  TimerList::disarmAll();
+  memset(s_pwm, 0, sizeof(s_pwm));
+  memset(s_pin, 0, sizeof(s_pin));
+}
+
+void hal::host::setTime(time_t epoch) { s_wallUs = (uint64_t)epoch * 1000000ULL; }
+
+void hal::host::advanceUs(uint64_t us) {
+  const uint64_t target = s_upUs + us;
+  while (Timer *t = TimerList::earliest(target)) {
+    const uint64_t due = TimerList::due(t);
+    if (due > s_upUs) {
+      s_wallUs += due - s_upUs;
+      s_upUs = due;
+    }
+    TimerList::fire(t);
+  }
+  s_wallUs += target - s_upUs;
+  s_upUs = target;
+}
+
+uint64_t hal::host::uptimeUs() { return s_upUs; }
+
+uint64_t hal::host::nextTimerUs() {
+  uint64_t due = TimerList::nextDue();
+  return (due == UINT64_MAX) ? UINT64_MAX : (due > s_upUs ? due - s_upUs : 0);
+}
+
+uint8_t hal::host::pwm(uint8_t ch) { return ch < sizeof(s_pwm) ? s_pwm[ch] : 0; }
+bool hal::host::pin(uint8_t pin) { return pin < sizeof(s_pin) ? s_pin[pin] : false; }
+uint32_t hal::host::pwmWrites() { return s_pwmWrites; }
+void hal::host::onPwm(PwmHook hook, void *ctx) { s_pwmHook = hook; s_pwmCtx = ctx; }
+
+void hal::host::setRoot(const char *dir) { s_root = dir; }
+const char *hal::host::root() { return rootDir().c_str(); }
+void hal::host::wipeFs() { removeTree(rootDir(), false); }
+hal::host::FsStats hal::host::fsStats() { return s_fsStats; }
+void hal::host::resetFsStats() { s_fsStats = {}; }
+void hal::host::failWritesAfter(uint64_t bytes) { s_writeBudget = bytes; }
+void hal::host::quiet(bool on) { s_quiet = on; }
+
+// ---- filesystem ----
+
+hal::File hal::FS::open(const char *path, const char *mode) {
+  File f;
+  std::string m = mode;
+  if (m.find('b') == std::string::npos) m += 'b';
+  FILE *fp = fopen(hostPath(path).c_str(), m.c_str());
+  if (!fp) return f;
+  s_fsStats.opens++;
+  f._f.reset(fp, fclose);
+  return f;
+}
+
+bool hal::FS::exists(const char *path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool hal::FS::remove(const char *path) { return unlink(hostPath(path).c_str()) == 0; }
+bool hal::FS::rename(const char *from, const char *to) { return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0; }
+bool hal::FS::mkdir(const char *path) { return ::mkdir(hostPath(path).c_str(), 0755) == 0; }
+bool hal::FS::rmdir(const char *path) { return ::rmdir(hostPath(path).c_str()) == 0; }
+
+// Sorted, so listings do not depend on the host filesystem's order
+hal::Dir hal::FS::openDir(const char *path) {
+  Dir d;
+  d._path = hostPath(path);
+  if (DIR *dp = opendir(d._path.c_str())) {
+    while (struct dirent *e = readdir(dp))
+      if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) d._names.push_back(e->d_name);
+    closedir(dp);
+  }
+  std::sort(d._names.begin(), d._names.end());
+  return d;
+}
+
+size_t hal::Dir::fileSize() const {
+  struct stat st;
+  if (!_i || _i > _names.size() || stat((_path + "/" + _names[_i - 1]).c_str(), &st) != 0) return 0;
+  return (size_t)st.st_size;
+}
+
+bool hal::Dir::isDirectory() const {
+  struct stat st;
+  return _i && _i <= _names.size() && stat((_path + "/" + _names[_i - 1]).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+size_t hal::File::read(uint8_t *buf, size_t n) {
+  if (!_f) return 0;
+  s_fsStats.reads++;
+  size_t got = fread(buf, 1, n, _f.get());
+  s_fsStats.bytesRead += got;
+  return got;
+}
+
+int hal::File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t hal::File::readBytesUntil(char term, char *buf, size_t n) {
+  size_t k = 0;
+  while (k < n) {
+    int c = read();
+    if (c < 0 || c == term) break;
+    buf[k++] = (char)c;
+  }
+  return k;
+}
+
+int hal::File::available() {
+  if (!_f) return 0;
+  long pos = ftell(_f.get());
+  size_t sz = size();
+  return (pos >= 0 && (size_t)pos < sz) ? (int)(sz - pos) : 0;
+}
+
+size_t hal::File::write(const uint8_t *buf, size_t n) {
+  if (!_f) return 0;
+  s_fsStats.writes++;
+  size_t put = fwrite(buf, 1, (size_t)min<uint64_t>(n, s_writeBudget), _f.get());
+  if (s_writeBudget != UINT64_MAX) s_writeBudget -= put;
+  s_fsStats.bytesWritten += put;
+  return put;
+}
+
+bool hal::File::seek(uint32_t pos, SeekMode mode) {
+  if (!_f) return false;
+  s_fsStats.seeks++;
+  int whence = (mode == SeekCur) ? SEEK_CUR : (mode == SeekEnd) ? SEEK_END : SEEK_SET;
+  return fseek(_f.get(), (long)pos, whence) == 0;
+}
+
+size_t hal::File::position() const {
+  long pos = _f ? ftell(_f.get()) : -1;
+  return pos < 0 ? 0 : (size_t)pos;
+}
+
+size_t hal::File::size() const {
+  if (!_f) return 0;
+  fflush(_f.get());
+  struct stat st;
+  return fstat(fileno(_f.get()), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+bool hal::File::truncate(uint32_t size) {
+  if (!_f) return false;
+  fflush(_f.get());
+  return ftruncate(fileno(_f.get()), size) == 0;
+}
+
+void hal::File::flush() {
+  if (_f) fflush(_f.get());
+}
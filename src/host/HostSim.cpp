@@ -0,0 +1,227 @@
+// Host-only dry run of the firmware's dosing path, see include/host/HostSim.h
+#include "host/HostSim.h"
+#include "Hal.h"
+#include "DoseSequencer.h"
+#include "Dosing.h"
+#include "Logger.h"
+#include "PumpControl.h"
+#include "Scheduler.h"
+
+namespace {
+  const PumpPins kPins[NUM_PUMPS] = { { 12, 13 }, { 14, 15 }, { 4, 5 } };
+  const char *kSettingsPath = "/settings.json";
+  constexpr uint32_t kBusyStepMs = 5;   // the "pumps" task period
+
+  // Eastern time, as TimeSetup configures the device
+  void applyTz() {
+    setenv("TZ", settings.useDST ? "EST5EDT,M3.2.0/2,M11.1.0/2" : "EST5", 1);
+    tzset();
+  }
+
+  uint32_t localMidnight(uint32_t epoch, int addDays) {
+    time_t t = epoch;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    tm.tm_mday += addDays;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    return (uint32_t)mktime(&tm);
+  }
+}
+
+bool parseInjects(const char *spec, uint32_t start, SimInject *out, uint8_t cap, uint8_t &count) {
+  const char *p = spec;
+  while (*p) {
+    SimInject in;
+    if (!strncmp(p, "reboot@", 7))     { in.kind = SimInject::Reboot; p += 7; }
+    else if (!strncmp(p, "jump@", 5))  { in.kind = SimInject::Jump;   p += 5; }
+    else if (!strncmp(p, "stall@", 6)) { in.kind = SimInject::Stall;  p += 6; }
+    else return false;
+    char *e;
+    in.at = start + (uint32_t)strtoul(p, &e, 10);
+    if (e == p) return false;
+    p = e;
+    in.arg = 0;
+    if (*p == ':') { in.arg = (int32_t)strtol(p + 1, &e, 10); p = e; }
+    if (in.arg <= -86400 || in.arg >= 86400) return false;   // faults stay under a day, so the ledger days stay apart
+    if (*p == ',') p++;
+    else if (*p) return false;
+    if (count >= cap) return false;
+    uint8_t k = count++;   // keep sorted by time
+    while (k > 0 && out[k - 1].at > in.at) { out[k] = out[k - 1]; k--; }
+    out[k] = in;
+  }
+  return true;
+}
+
+bool HostSim::loadJson(const char *json) {
+  JsonDocument doc;
+  if (deserializeJson(doc, json)) return false;
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::File f = hal::fs().open(kSettingsPath, "w");
+  if (!f) return false;
+  f.write((const uint8_t *)json, strlen(json));
+  f.close();
+  settings = Settings();
+  settingsLoad();   // the first-boot import: settings.json -> binary images
+  applyTz();
+  return !hal::fs().exists(kSettingsPath);   // removed once imported
+}
+
+bool HostSim::loadFile(const char *hostPath) {
+  FILE *f = fopen(hostPath, "rb");
+  if (!f) return false;
+  std::string json;
+  char buf[512];
+  while (size_t n = fread(buf, 1, sizeof(buf), f)) json.append(buf, n);
+  fclose(f);
+  return loadJson(json.c_str());
+}
+
+// What setup() does after a power cycle: settings from the images, log and
+// fire state from their files, no queued jobs, pumps off
+void HostSim::boot() {
+  settings = Settings();
+  settingsLoad();
+  applyTz();
+  scheduler = Scheduler();
+  sequencer = DoseSequencer();
+  pumpCtl = PumpControl();
+  Logger::begin();
+  pumpCtl.begin(kPins);
+  scheduler.begin();
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) {
+    _duty[p] = 0;
+    _dutyUs[p] = hal::host::uptimeUs();
+    _runDay[p] = -1;
+  }
+}
+
+int32_t HostSim::dayOf(uint32_t epoch) const {
+  if (_days.empty() || epoch < _days[0].startEpoch || epoch >= _end) return -1;
+  int32_t d = (int32_t)_days.size() - 1;
+  while (d > 0 && _days[d].startEpoch > epoch) d--;
+  return d;
+}
+
+void HostSim::onPwm(void *ctx, uint8_t ch, uint8_t duty) {
+  if (ch < NUM_PUMPS) static_cast<HostSim *>(ctx)->account(ch, duty);
+}
+
+// Volume at the previous duty up to now; a rise from 0 starts a run
+void HostSim::account(uint8_t pump, uint8_t duty) {
+  const uint64_t now = hal::host::uptimeUs();
+  if (_duty[pump] && _runDay[pump] >= 0)
+    _days[_runDay[pump]].dosedMl[pump] += (float)(flowAt(settings.pump[pump], _duty[pump]) * (double)(now - _dutyUs[pump]) / 1e6);
+  if (!_duty[pump] && duty) {
+    _runDay[pump] = dayOf((uint32_t)hal::now());
+    if (_runDay[pump] >= 0) _days[_runDay[pump]].runs[pump]++;
+  }
+  _duty[pump] = duty;
+  _dutyUs[pump] = now;
+}
+
+void HostSim::apply(const SimInject &in) {
+  const time_t now = hal::now();
+  switch (in.kind) {
+    case SimInject::Reboot:
+      Logger::flush();
+      for (uint8_t p = 0; p < NUM_PUMPS; ++p) account(p, 0);   // power gone: outputs drop
+      hal::host::reboot();
+      hal::host::setTime(now + max<int32_t>(in.arg, 0));
+      _reboots++;
+      boot();
+      break;
+    case SimInject::Jump:
+      hal::host::setTime(now + in.arg);
+      break;
+    case SimInject::Stall:
+      hal::host::advanceUs((uint64_t)max<int32_t>(in.arg, 0) * 1000000ULL);
+      break;
+  }
+}
+
+bool HostSim::busy() const {
+  if (pumpCtl.anyRunning()) return true;
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p)
+    if (sequencer.pendingMl(p) > 0.0f) return true;
+  return false;
+}
+
+// The loop tasks in main.cpp's order, every 5 ms while anything doses;
+// idle stretches jump to the next scheduled event or fault
+void HostSim::runUntil(uint32_t until) {
+  while ((uint32_t)hal::now() < until) {
+    while (_injNext < _injCount && _inj[_injNext].at <= (uint32_t)hal::now()) apply(_inj[_injNext++]);
+    pumpCtl.loop();
+    scheduler.loop();
+    sequencer.loop();
+    Logger::loop(!pumpCtl.anyRunning());
+
+    uint64_t stepMs = kBusyStepMs;
+    if (!busy()) {
+      const uint32_t now = (uint32_t)hal::now();
+      stepMs = (uint64_t)(until - now) * 1000;
+      stepMs = min<uint64_t>(stepMs, scheduler.msUntilNext());
+      if (_injNext < _injCount && _inj[_injNext].at > now) stepMs = min<uint64_t>(stepMs, (uint64_t)(_inj[_injNext].at - now) * 1000);
+      if (stepMs < 1) stepMs = 1;
+    }
+    hal::host::advanceUs(stepMs * 1000);
+  }
+}
+
+bool HostSim::run(uint32_t start, uint16_t days, const char *inject) {
+  const uint32_t t0 = localMidnight(start, 0);
+  _injCount = _injNext = 0;
+  _reboots = 0;
+  if (inject && !parseInjects(inject, t0, _inj, kMaxInject, _injCount)) return false;
+
+  _days.assign(days, Day());
+  for (uint16_t d = 0; d < days; ++d) {
+    Day &day = _days[d];
+    day.startEpoch = localMidnight(t0, d);
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p)
+      for (uint8_t t = 0; t < settings.pump[p].timesCount; ++t) day.expectedMl[p] += settings.pump[p].doseML[t];
+  }
+  _end = localMidnight(t0, days);
+
+  hal::host::reboot();
+  hal::host::setTime(t0);
+  hal::host::onPwm(onPwm, this);
+  boot();
+  runUntil(_end + 3600);   // let runs started on the last day finish
+  Logger::flush();
+  hal::host::onPwm(nullptr, nullptr);
+  return true;
+}
+
+uint16_t HostSim::mismatched() const {
+  uint16_t n = 0;
+  for (const Day &d : _days)
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p)
+      if (fabsf(d.dosedMl[p] - d.expectedMl[p]) > kTolMl) n++;
+  return n;
+}
+
+void HostSim::report(FILE *out) const {
+  fprintf(out, "date,pump,expected_ml,dosed_ml,runs,status\n");
+  double expected = 0, dosed = 0;
+  for (const Day &d : _days) {
+    time_t t = d.startEpoch;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char date[12];
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p) {
+      if (d.expectedMl[p] <= 0.0f && !d.runs[p]) continue;
+      const float diff = d.dosedMl[p] - d.expectedMl[p];
+      const char *status = (fabsf(diff) <= kTolMl) ? "ok" : (diff < 0) ? "short" : "over";
+      fprintf(out, "%s,%u,%.2f,%.3f,%u,%s\n", date, p, d.expectedMl[p], d.dosedMl[p], d.runs[p], status);
+      expected += d.expectedMl[p];
+      dosed += d.dosedMl[p];
+    }
+  }
+  fprintf(out, "# days=%u mismatched=%u reboots=%u expected_ml=%.2f dosed_ml=%.2f\n", (unsigned)_days.size(),
+          mismatched(), _reboots, expected, dosed);
+}
@@ -0,0 +1,47 @@
+// Command-line front end of HostSim; `pio run -e native` builds it as
+// .pio/build/native/program:
+//
+//   program <settings.json> [days] [start YYYY-MM-DD] [inject]
+//   program settings.json 365 2024-01-01 reboot@30000:600,jump@900000:-3600
+//
+// Prints the per-day ledger on stdout; exit status 1 if any day is off.
+// The test runner links its own main(), so this one is left out there.
+#ifndef PIO_UNIT_TESTING
+#include "host/HostSim.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <settings.json> [days] [start YYYY-MM-DD] [inject]\n", argv[0]);
+    return 2;
+  }
+  hal::host::quiet(true);
+  static HostSim sim;
+  if (!sim.loadFile(argv[1])) {
+    fprintf(stderr, "%s: cannot import %s\n", argv[0], argv[1]);
+    return 2;
+  }
+  const long days = (argc > 2) ? strtol(argv[2], nullptr, 10) : 30;
+  if (days < 1 || days > 3660) {
+    fprintf(stderr, "%s: bad days\n", argv[0]);
+    return 2;
+  }
+  struct tm tm = {};
+  tm.tm_year = 2024 - 1900;
+  tm.tm_mday = 1;
+  if (argc > 3) {
+    if (sscanf(argv[3], "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) {
+      fprintf(stderr, "%s: bad start date\n", argv[0]);
+      return 2;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+  }
+  tm.tm_isdst = -1;
+  if (!sim.run((uint32_t)mktime(&tm), (uint16_t)days, argc > 4 ? argv[4] : nullptr)) {
+    fprintf(stderr, "%s: bad inject spec\n", argv[0]);
+    return 2;
+  }
+  sim.report(stdout);
+  return sim.mismatched() ? 1 : 0;
+}
+#endif
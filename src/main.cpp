@@ -14,6 +14,11 @@
 #include "Scheduler.h"
 #include "WebServerSetup.h"
 #include "Logger.h"
+#include "TaskRunner.h"
+#include "DoseSequencer.h"
+#include "HeapStats.h"
+#include "Telemetry.h"
+#include "Trace.h"
 
 // ---- Pin map (edit these) ----
 // Example pins for ESP32 DevKit + DRV8871
@@ -29,8 +34,6 @@ static const PumpPins PINS[NUM_PUMPS] = {
   char wifiSsid[32]   = "PHD1 2.4";
   char wifiPass[64]   = "Andrew1Laura2";
   char hostname[32]   = "esp32-doser";
-  const char* I = "Info";
-  const char* setcomp = "setup complete";
 
 
 static void connectWiFi() {
@@ -71,6 +74,11 @@ int secToday = t.tm_hour*3600 + t.tm_min*60 + t.tm_sec;
 Serial.printf("Time now: %02d:%02d:%02d (seconds=%d)\n",t.tm_hour, t.tm_min, t.tm_sec, secToday);
 } */
 
+// A task that finds no slot would silently never run
+static void addTask(const char *name, TaskFn fn, uint32_t periodMs, uint32_t deadlineMs) {
+  if (Tasks::add(name, fn, periodMs, deadlineMs) < 0) logErr("tasks: no slot for %s, raise TASK_MAX", name);
+}
+
 void setup() {
   Serial.begin(115200);
   delay(100);
@@ -87,19 +95,27 @@ void setup() {
   printCurrentTimeInfo();
   Serial.printf("secSinceMidnight = %u\n", secondsSinceMidnight());
 
-  Logger::begin();        // create /logs.csv with header if missing
+  Logger::begin();        // recover the /logs/NNN.bin segment chain and its index, import an old /logs.csv
   pumpCtl.begin(PINS);
   scheduler.begin();
   webserverBegin();
 
-  Logger::logEvent(I, 999, 0,0,0,0,0,setcomp);
+  // Main-loop work: name, function, period ms, deadline ms. Stop edges are
+  // timer driven, so the pump task only does the bookkeeping after them.
+  addTask("pumps", []{ pumpCtl.loop(); }, 5, 5);
+  addTask("scheduler", []{ scheduler.loop(); }, 100, 500);
+  addTask("doses", []{ sequencer.loop(); }, 20, 100);
+  addTask("web", webserverLoop, 20, 100);
+  addTask("log", []{ Logger::loop(!pumpCtl.anyRunning()); }, 50, 1000);   // batched log flush in the idle slot
+  addTask("heap", HeapStats::sample, 1000, 1000);   // watermarks for /api/heap
+  addTask("telemetry", Telemetry::sample, TELEMETRY_PERIOD_MS, 1000);   // ring behind /api/perf?series=
+#if TRACE_ENABLED
+  addTask("trace", Trace::loop, 200, 1000);   // 't' / 'r' on Serial
+#endif
+
+  Logger::logEvent(LogEvent::Info, 999, 0,0,0,0,0, LogStatus::SetupComplete);
 }
 
 void loop() {
-  pumpCtl.loop();
-  delay(10);
-  scheduler.loop();
-  delay(10);
-  webserverLoop();
-  delay(10);
+  Tasks::run();
 }
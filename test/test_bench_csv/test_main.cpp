@@ -0,0 +1,174 @@
+// Allocations and time per row for turning a log line into a JSON object:
+// the String-based route older firmware used (splitCsvLine, rstrip,
+// jsonEscape, toDouble -> "%.3f") against CsvTokenizer views and the
+// fixed-point record rendering. Heap allocations are counted with a global
+// operator new. std::string stands in for Arduino String; its small-string
+// buffer spares short fields, so the legacy count here is a lower bound.
+#include <unity.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include "Hal.h"
+#include "CsvTokenizer.h"
+#include "Logger.h"
+
+static uint32_t s_allocs = 0;
+
+void *operator new(size_t n) {
+  s_allocs++;
+  if (void *p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ---- the helpers of the old LogRoutes.h, on std::string ----
+
+static std::string jsonEscape(const std::string &s) {
+  std::string out;
+  out.reserve(s.length() + 8);
+  for (char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default: out += c;
+    }
+  }
+  return out;
+}
+
+static void splitCsvLine(const std::string &line, char delim, std::vector<std::string> &out) {
+  out.clear();
+  std::string cur;
+  cur.reserve(line.length());
+  bool inQuotes = false;
+  for (char ch : line) {
+    if (ch == '"') inQuotes = !inQuotes;
+    else if (!inQuotes && ch == delim) { out.push_back(cur); cur = std::string(); }
+    else cur += ch;
+  }
+  out.push_back(cur);
+}
+
+static std::string rstrip(const std::string &s) {
+  int end = (int)s.length() - 1;
+  while (end >= 0 && (s[end] == '\r' || s[end] == ' ' || s[end] == '\t')) end--;
+  return s.substr(0, end + 1);
+}
+
+// One row of the old /api/log.json handler (columns in file order)
+static size_t legacyRow(const std::string &raw, std::vector<std::string> &parts, char *out, size_t cap) {
+  std::string line = rstrip(raw);
+  splitCsvLine(line, ',', parts);
+  auto getS = [&](size_t i) { return i < parts.size() ? parts[i] : std::string(); };
+  auto getD = [&](size_t i) { return i < parts.size() ? atof(parts[i].c_str()) : 0.0; };
+  std::string ts = getS(0), ev = getS(2), status = getS(9);
+  int n = snprintf(out, cap,
+                   "{\"ts\":\"%s\",\"uptime_ms\":%ld,\"event\":\"%s\",\"pump\":%d,\"runtime\":%.3f,\"mlps\":%.3f,"
+                   "\"ml\":%.3f,\"duty\":%d,\"dir\":%d,\"status\":\"%s\"}",
+                   jsonEscape(ts).c_str(), (long)getD(1), jsonEscape(ev).c_str(), (int)getD(3), getD(4), getD(5),
+                   getD(6), (int)getD(7), (int)getD(8), jsonEscape(status).c_str());
+  return n > 0 ? (size_t)n : 0;
+}
+
+// ---- current path: field views into the line, fixed-point record ----
+
+static size_t tokenRow(const char *raw, size_t len, char *out, size_t cap) {
+  char line[160];
+  memcpy(line, raw, len);
+  len = csvRstrip(line, len);
+  CsvField f[12];
+  size_t nf = csvSplit(line, len, ',', f, 12);
+  static const CsvField kEmpty = { "", 0 };
+  auto get = [&](size_t i) -> const CsvField & { return i < nf ? f[i] : kEmpty; };
+  LogRecord r = {};
+  r.ts = 1709269200;   // the timestamp parse (mktime) is the same in both paths
+  r.uptimeMs = (uint32_t)csvToLong(get(1));
+  r.event = csvEquals(get(2), "Stop") ? (uint8_t)LogEvent::Stop : (uint8_t)LogEvent::Run;
+  r.pump = (int16_t)csvToLong(get(3));
+  r.runtimeC = csvToCenti(get(4));
+  r.mlpsC = (uint16_t)csvToCenti(get(5));
+  r.mlC = csvToCenti(get(6));
+  r.duty = (uint8_t)csvToLong(get(7));
+  r.dir = (int8_t)csvToLong(get(8));
+  return Logger::formatJson(r, out, cap);
+}
+
+static std::vector<std::string> sampleLines(size_t n) {
+  std::vector<std::string> lines;
+  char buf[160];
+  for (size_t i = 0; i < n; ++i) {
+    float rt = 1.0f + (i % 50) * 0.37f;
+    snprintf(buf, sizeof(buf), "2024-03-%02u %02u:%02u:00,%lu,%s,%u,%.2f,%.2f,%.2f,%u,%d,%s\r\n",
+             (unsigned)(1 + i % 28), (unsigned)(i % 24), (unsigned)(i % 60), (unsigned long)(i * 1000 + 17),
+             (i % 2) ? "Stop" : "Run", (unsigned)(i % 3), rt, 1.25f, rt * 1.25f, 200u, (i % 2) ? 0 : 1,
+             (i % 2) ? "--" : "setup complete");
+    lines.push_back(std::string(buf, strlen(buf) - 1));   // readStringUntil('\n') drops the newline
+  }
+  return lines;
+}
+
+void setUp() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+}
+void tearDown() {}
+
+static void test_bench_allocations_per_row() {
+  const size_t rows = 5000;
+  std::vector<std::string> lines = sampleLines(rows);
+  std::vector<std::string> parts;
+  char out[256];
+  size_t bytes = 0;
+
+  legacyRow(lines[0], parts, out, sizeof(out));   // let the parts vector reach its size
+  s_allocs = 0;
+  uint64_t t0 = nowNs();
+  for (const std::string &l : lines) bytes += legacyRow(l, parts, out, sizeof(out));
+  uint64_t legacyNs = nowNs() - t0;
+  uint32_t legacyAllocs = s_allocs;
+
+  s_allocs = 0;
+  t0 = nowNs();
+  for (const std::string &l : lines) bytes += tokenRow(l.data(), l.size(), out, sizeof(out));
+  uint64_t tokenNs = nowNs() - t0;
+  uint32_t tokenAllocs = s_allocs;
+
+  char msg[160];
+  snprintf(msg, sizeof(msg), "String route: %.1f allocs/row, %lu ns/row | tokenizer: %.1f allocs/row, %lu ns/row",
+           (double)legacyAllocs / rows, (unsigned long)(legacyNs / rows), (double)tokenAllocs / rows,
+           (unsigned long)(tokenNs / rows));
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(bytes > 0);
+  TEST_ASSERT_EQUAL_UINT32(0, tokenAllocs);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(4 * rows, legacyAllocs);
+}
+
+// Numbers go through as the text the log holds, not a double reprinted "%.3f"
+static void test_numbers_are_not_reformatted() {
+  const char *l = "2024-03-01 08:00:00,17,Stop,1,2.34,1.25,2.93,200,0,--";
+  char out[256];
+  size_t n = tokenRow(l, strlen(l), out, sizeof(out));
+  std::string json(out, n);
+  TEST_ASSERT_TRUE(json.find("\"runtime\":2.34,") != std::string::npos);
+  TEST_ASSERT_TRUE(json.find("\"ml\":2.93,") != std::string::npos);
+  std::vector<std::string> parts;
+  n = legacyRow(l, parts, out, sizeof(out));
+  TEST_ASSERT_TRUE(std::string(out, n).find("\"runtime\":2.340,") != std::string::npos);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_allocations_per_row);
+  RUN_TEST(test_numbers_are_not_reformatted);
+  return UNITY_END();
+}
@@ -0,0 +1,157 @@
+// Tail of a ~1 MB log: the old byte-at-a-time backwards scan of the CSV
+// file vs. LogReader's block reads over the binary segments. On the host
+// the file sits in the page cache, so wall time understates the gap on
+// LittleFS; the seek/read call counts are what carries over to the device
+// and what is asserted.
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "Hal.h"
+#include "Logger.h"
+
+static const time_t kT0 = 1709269200;   // 2024-03-01 00:00 EST
+static const char *kCsvPath = "/bench.csv";
+static uint32_t s_rows = 0;
+
+static uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The pre-binary Logger::tail(): one seek + one read per byte going back
+static std::string legacyTail(size_t maxLines) {
+  hal::File f = hal::fs().open(kCsvPath, "r");
+  if (!f) return std::string();
+  int64_t pos = (int64_t)f.size() - 1;
+  size_t lines = 0;
+  while (pos >= 0 && lines <= maxLines) {
+    f.seek((uint32_t)pos, SeekSet);
+    int c = f.read();
+    if (c == '\n') { lines++; if (lines > maxLines) { pos++; break; } }
+    pos--;
+  }
+  if (pos < 0) pos = 0;
+  f.seek((uint32_t)pos, SeekSet);
+  std::string out;
+  while (f.available()) out += char(f.read());
+  f.close();
+  return out;
+}
+
+// Newest maxLines records: backwards block walk, then render forwards
+static std::string blockTail(size_t maxLines) {
+  LogReader rd;
+  std::string out;
+  if (!rd.open()) return out;
+  LogRecord r;
+  char line[160];
+  for (uint32_t i = Logger::tailStart(rd, maxLines, LogQuery()); i < rd.size() && rd.read(i, r); ++i)
+    out.append(line, Logger::formatCsv(r, line, sizeof(line)));
+  rd.close();
+  return out;
+}
+
+static size_t countLines(const std::string &s) {
+  size_t n = 0;
+  for (char c : s) n += (c == '\n');
+  return n;
+}
+
+struct Cost {
+  uint64_t ns;
+  hal::host::FsStats fs;
+  std::string out;
+};
+
+template <typename Fn>
+static Cost measure(Fn fn) {
+  Cost c;
+  hal::host::resetFsStats();
+  uint64_t t0 = nowNs();
+  c.out = fn();
+  c.ns = nowNs() - t0;
+  c.fs = hal::host::fsStats();
+  return c;
+}
+
+// Same rows twice: as the old CSV text file and as binary records
+static void buildLogs() {
+  std::string csv = "ts,uptime_ms,event,pump,runtime,mlps,ml,duty,dir,status\n";
+  char line[160], when[24];
+  for (s_rows = 0; csv.size() < 1000000; ++s_rows) {
+    time_t t = kT0 + s_rows * 300;
+    hal::host::setTime(t);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    float runtime = 2.0f + (s_rows % 97) * 0.13f;
+    snprintf(line, sizeof(line), "%s,%lu,%s,%d,%.2f,%.2f,%.2f,%d,%d,%s\n", when, (unsigned long)hal::millis(),
+             "Stop", (int)(s_rows % 3), runtime, 1.25f, runtime * 1.25f, 200, 0, "--");
+    csv += line;
+    Logger::logEvent(LogEvent::Stop, (int)(s_rows % 3), runtime, 1.25f, runtime * 1.25f, 200, 0);
+    Logger::loop(true);
+  }
+  Logger::flush();
+  hal::File f = hal::fs().open(kCsvPath, "w");
+  f.write((const uint8_t *)csv.data(), csv.size());
+  f.close();
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_log_holds_the_whole_megabyte() {
+  LogReader rd;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(s_rows, rd.size());   // needs LOG_MAX_SEGMENTS=80, see [env:native]
+  rd.close();
+  TEST_ASSERT_TRUE(hal::fs().open(kCsvPath, "r").size() >= 1000000);
+}
+
+static void tailOf(size_t n) {
+  Cost old = measure([&] { return legacyTail(n); });
+  Cost blk = measure([&] { return blockTail(n); });
+  char msg[200];
+  snprintf(msg, sizeof(msg), "tail %4u: byte scan %7lu us, %6lu seeks, %6lu reads | blocks %5lu us, %4lu seeks, %4lu reads",
+           (unsigned)n, (unsigned long)(old.ns / 1000), (unsigned long)old.fs.seeks, (unsigned long)old.fs.reads,
+           (unsigned long)(blk.ns / 1000), (unsigned long)blk.fs.seeks, (unsigned long)blk.fs.reads);
+  TEST_MESSAGE(msg);
+
+  TEST_ASSERT_EQUAL_UINT32(n, countLines(old.out));
+  TEST_ASSERT_EQUAL_UINT32(n, countLines(blk.out));
+  // Same rows: each block-rendered line is the legacy line plus overshoot_ms
+  for (size_t a = 0, b = 0; a < old.out.size(); ) {
+    size_t len = old.out.find('\n', a) - a;
+    TEST_ASSERT_EQUAL_STRING_LEN(old.out.c_str() + a, blk.out.c_str() + b, len);
+    a += len + 1;
+    b = blk.out.find('\n', b) + 1;
+  }
+
+  // One seek + one read per 16-record block and segment, both directions
+  const uint32_t blocks = (uint32_t)(2 * (n / 16 + 2) + n / 256 + 2);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(blocks, blk.fs.seeks);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(blocks, blk.fs.reads);
+  TEST_ASSERT_GREATER_THAN_UINT32(100 * blk.fs.reads, old.fs.reads);
+}
+
+static void test_bench_tail_50() { tailOf(50); }
+static void test_bench_tail_500() { tailOf(500); }
+static void test_bench_tail_2000() { tailOf(2000); }
+
+int main() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  Logger::begin();
+  Logger::clear();
+  buildLogs();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_log_holds_the_whole_megabyte);
+  RUN_TEST(test_bench_tail_50);
+  RUN_TEST(test_bench_tail_500);
+  RUN_TEST(test_bench_tail_2000);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// Host benchmarks for the scheduler hot path. Times are host nanoseconds and
+// only printed (compare runs on one machine); what is asserted is the work
+// done: an idle pass must not touch the filesystem and a simulated year must
+// book every dose.
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "Hal.h"
+#include "Settings.h"
+#include "Scheduler.h"
+#include "host/HostSim.h"
+#include "Logger.h"
+
+static const time_t kJan1 = 1704085200;   // 2024-01-01 00:00 EST
+
+static uint64_t nowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char *what, uint64_t ns, uint32_t n) {
+  char msg[96];
+  snprintf(msg, sizeof(msg), "%s: %lu ns/op over %lu ops", what, (unsigned long)(ns / n), (unsigned long)n);
+  TEST_MESSAGE(msg);
+}
+
+// Every pump on every slot, spread over the day
+static void fullSchedule() {
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) {
+    PumpConfig &pc = settings.pump[p];
+    pc.timesCount = MAX_TIMES_PER_DAY;
+    for (uint8_t t = 0; t < MAX_TIMES_PER_DAY; ++t) {
+      pc.timesSec[t] = t * 3 * 3600 + p * 600;
+      pc.doseML[t] = 0.5f;
+    }
+  }
+}
+
+void setUp() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::host::setTime(kJan1 + 60);
+  settings = Settings();
+  fullSchedule();
+  Logger::begin();
+  Logger::clear();
+  scheduler = Scheduler();
+  scheduler.begin();
+  scheduler.loop();   // build the timeline
+}
+
+void tearDown() {}
+
+// Nothing due: loop() is a compare against the head of the timeline
+static void test_bench_idle_loop() {
+  const uint32_t n = 1000000;
+  hal::host::resetFsStats();
+  uint64_t t0 = nowNs();
+  for (uint32_t i = 0; i < n; ++i) scheduler.loop();
+  report("scheduler.loop idle", nowNs() - t0, n);
+  hal::host::FsStats st = hal::host::fsStats();
+  TEST_ASSERT_EQUAL_UINT32(0, st.opens + st.reads + st.writes);
+}
+
+static void test_bench_next_run_queries() {
+  const uint32_t n = 1000000;
+  volatile uint32_t sink = 0;
+  uint64_t t0 = nowNs();
+  for (uint32_t i = 0; i < n; ++i) sink += scheduler.nextRunSec(i % NUM_PUMPS) + scheduler.msUntilNext();
+  report("nextRunSec + msUntilNext", nowNs() - t0, n);
+  TEST_ASSERT_TRUE(scheduler.nextRunSec(0) < 24 * 3600);
+}
+
+// Full rebuild vs re-planning one pump after a settings change
+static void test_bench_replan() {
+  const uint32_t n = 20000;
+  uint64_t t0 = nowNs();
+  for (uint32_t i = 0; i < n; ++i) { scheduler.invalidate(); scheduler.loop(); }
+  report("invalidate() + loop", nowNs() - t0, n);
+  t0 = nowNs();
+  for (uint32_t i = 0; i < n; ++i) { scheduler.invalidate(1); scheduler.loop(); }
+  report("invalidate(pump) + loop", nowNs() - t0, n);
+  TEST_ASSERT_EQUAL_UINT32(600 - 60, scheduler.nextRunSec(1));
+}
+
+// fullSchedule() as the settings.json HostSim boots from
+static std::string fullScheduleJson() {
+  std::string json = "{\"pumps\":[";
+  char buf[48];
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) {
+    snprintf(buf, sizeof(buf), "%s{\"idx\":%u,\"times\":[", p ? "," : "", p);
+    json += buf;
+    for (uint8_t t = 0; t < MAX_TIMES_PER_DAY; ++t) {
+      snprintf(buf, sizeof(buf), "%s{\"sec\":%u,\"ml\":0.5}", t ? "," : "", t * 3 * 3600 + p * 600);
+      json += buf;
+    }
+    json += "]}";
+  }
+  return json + "]}";
+}
+
+static void test_bench_simulated_year() {
+  static HostSim sim;
+  TEST_ASSERT_TRUE(sim.loadJson(fullScheduleJson().c_str()));
+  uint64_t t0 = nowNs();
+  TEST_ASSERT_TRUE(sim.run((uint32_t)kJan1, 366));
+  report("simulated year (per day)", nowNs() - t0, 366);
+  TEST_ASSERT_EQUAL_size_t(366, sim.days().size());
+  TEST_ASSERT_EQUAL_UINT16(0, sim.mismatched());
+  for (const HostSim::Day &d : sim.days())
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p) TEST_ASSERT_EQUAL_UINT16(MAX_TIMES_PER_DAY, d.runs[p]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_idle_loop);
+  RUN_TEST(test_bench_next_run_queries);
+  RUN_TEST(test_bench_replan);
+  RUN_TEST(test_bench_simulated_year);
+  return UNITY_END();
+}
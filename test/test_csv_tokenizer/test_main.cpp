@@ -0,0 +1,127 @@
+// CsvTokenizer.h: field views, quoting, delimiter detection and the
+// digit-by-digit number parsing the legacy /logs.csv import relies on.
+#include <unity.h>
+#include <string>
+#include "CsvTokenizer.h"
+
+static std::string str(const CsvField &f) { return std::string(f.p, f.len); }
+
+static CsvField field(const char *s) { return { s, (uint16_t)strlen(s) }; }
+
+void setUp() {}
+void tearDown() {}
+
+static void test_rstrip() {
+  TEST_ASSERT_EQUAL_size_t(3, csvRstrip("abc\r", 4));
+  TEST_ASSERT_EQUAL_size_t(3, csvRstrip("abc \t \r", 7));
+  TEST_ASSERT_EQUAL_size_t(4, csvRstrip(" abc", 4));   // leading blanks stay
+  TEST_ASSERT_EQUAL_size_t(0, csvRstrip("\r", 1));
+  TEST_ASSERT_EQUAL_size_t(0, csvRstrip("", 0));
+}
+
+static void test_detect_delim() {
+  const char *c = "ts,pump,ml";
+  const char *s = "ts;pump;ml,total";
+  TEST_ASSERT_EQUAL_INT(',', csvDetectDelim(c, strlen(c)));
+  TEST_ASSERT_EQUAL_INT(';', csvDetectDelim(s, strlen(s)));
+  TEST_ASSERT_EQUAL_INT(',', csvDetectDelim("", 0));
+}
+
+// Views point into the line; blanks around fields are trimmed
+static void test_split_views_into_the_line() {
+  const char *line = "2024-03-01 08:00:00, 1234 ,Run,0,2.00";
+  CsvField f[8];
+  size_t n = csvSplit(line, strlen(line), ',', f, 8);
+  TEST_ASSERT_EQUAL_size_t(5, n);
+  TEST_ASSERT_EQUAL_STRING("2024-03-01 08:00:00", str(f[0]).c_str());
+  TEST_ASSERT_EQUAL_STRING("1234", str(f[1]).c_str());
+  TEST_ASSERT_EQUAL_STRING("2.00", str(f[4]).c_str());
+  TEST_ASSERT_TRUE(f[2].p == line + 27);
+}
+
+static void test_split_empty_fields() {
+  CsvField f[8];
+  TEST_ASSERT_EQUAL_size_t(4, csvSplit(",a,,", 4, ',', f, 8));
+  TEST_ASSERT_EQUAL_UINT16(0, f[0].len);
+  TEST_ASSERT_EQUAL_STRING("a", str(f[1]).c_str());
+  TEST_ASSERT_EQUAL_UINT16(0, f[2].len);
+  TEST_ASSERT_EQUAL_UINT16(0, f[3].len);
+  TEST_ASSERT_EQUAL_size_t(1, csvSplit("", 0, ',', f, 8));
+}
+
+static void test_split_quotes() {
+  const char *line = "\"a,b\";\"setup complete\"; \"x\" ;plain";
+  CsvField f[8];
+  size_t n = csvSplit(line, strlen(line), ';', f, 8);
+  TEST_ASSERT_EQUAL_size_t(4, n);
+  TEST_ASSERT_EQUAL_STRING("a,b", str(f[0]).c_str());
+  TEST_ASSERT_EQUAL_STRING("setup complete", str(f[1]).c_str());
+  TEST_ASSERT_EQUAL_STRING("x", str(f[2]).c_str());
+  TEST_ASSERT_EQUAL_STRING("plain", str(f[3]).c_str());
+}
+
+// Extra fields are not written past the caller's array
+static void test_split_stops_at_max_fields() {
+  CsvField f[4] = {};
+  f[3] = { nullptr, 0xBEEF };
+  const char *line = "1,2,3,4,5";
+  TEST_ASSERT_EQUAL_size_t(3, csvSplit(line, strlen(line), ',', f, 3));
+  TEST_ASSERT_EQUAL_STRING("3", str(f[2]).c_str());
+  TEST_ASSERT_EQUAL_UINT16(0xBEEF, f[3].len);
+}
+
+static void test_name_matching_ignores_case() {
+  TEST_ASSERT_TRUE(csvStartsWith(field("Uptime_MS"), "uptime_ms"));
+  TEST_ASSERT_TRUE(csvStartsWith(field("ml (total)"), "ml"));
+  TEST_ASSERT_FALSE(csvStartsWith(field("m"), "ml"));
+  TEST_ASSERT_TRUE(csvEquals(field("STOP"), "Stop"));
+  TEST_ASSERT_FALSE(csvEquals(field("Stopped"), "Stop"));
+  TEST_ASSERT_FALSE(csvEquals(field("Sto"), "Stop"));
+}
+
+static void test_to_long() {
+  TEST_ASSERT_EQUAL_INT32(1234, csvToLong(field("1234")));
+  TEST_ASSERT_EQUAL_INT32(-1, csvToLong(field("-1")));
+  TEST_ASSERT_EQUAL_INT32(7, csvToLong(field("+7")));
+  TEST_ASSERT_EQUAL_INT32(12, csvToLong(field("12.9")));   // stops at the first non-digit
+  TEST_ASSERT_EQUAL_INT32(0, csvToLong(field("")));
+  TEST_ASSERT_EQUAL_INT32(0, csvToLong(field("abc")));
+}
+
+static void test_to_centi() {
+  TEST_ASSERT_EQUAL_INT32(150, csvToCenti(field("1.5")));
+  TEST_ASSERT_EQUAL_INT32(200, csvToCenti(field("2")));
+  TEST_ASSERT_EQUAL_INT32(1234, csvToCenti(field("12.34")));
+  TEST_ASSERT_EQUAL_INT32(5, csvToCenti(field("0.05")));
+  TEST_ASSERT_EQUAL_INT32(-13, csvToCenti(field("-0.125")));
+  TEST_ASSERT_EQUAL_INT32(12, csvToCenti(field("0.124")));
+  TEST_ASSERT_EQUAL_INT32(13, csvToCenti(field("0.1259")));  // only the third decimal rounds
+  TEST_ASSERT_EQUAL_INT32(50, csvToCenti(field(".5")));
+  TEST_ASSERT_EQUAL_INT32(0, csvToCenti(field("")));
+}
+
+// Every "%.2f" text converts back to the hundredths it came from
+static void test_to_centi_inverts_two_decimals() {
+  char buf[16];
+  for (int32_t v = -20000; v <= 20000; v += 7) {
+    const char *sign = (v < 0) ? "-" : "";
+    int32_t a = (v < 0) ? -v : v;
+    snprintf(buf, sizeof(buf), "%s%ld.%02ld", sign, (long)(a / 100), (long)(a % 100));
+    TEST_ASSERT_EQUAL_INT32(v, csvToCenti(field(buf)));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rstrip);
+  RUN_TEST(test_detect_delim);
+  RUN_TEST(test_split_views_into_the_line);
+  RUN_TEST(test_split_empty_fields);
+  RUN_TEST(test_split_quotes);
+  RUN_TEST(test_split_stops_at_max_fields);
+  RUN_TEST(test_name_matching_ignores_case);
+  RUN_TEST(test_to_long);
+  RUN_TEST(test_to_centi);
+  RUN_TEST(test_to_centi_inverts_two_decimals);
+  return UNITY_END();
+}
@@ -0,0 +1,173 @@
+// LogRecord <-> CSV against the text log older firmware wrote: the first
+// ten columns rendered from a record must be exactly what the old
+// "%s,%lu,%s,%d,%.2f,%.2f,%.2f,%d,%d,%s" line was, both for new events and
+// for rows imported from /logs.csv.
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "Hal.h"
+#include "Logger.h"
+
+static const time_t kT0 = 1709269200;   // 2024-03-01 00:00 EST
+
+struct Row {
+  LogEvent event;
+  int pump;
+  float runtime, mlps, ml;
+  int duty, dir;
+  LogStatus status;
+};
+
+static const char *const kLegacyEvents[] = { "Info", "Run", "Prime", "Purge", "Stop" };
+static const char *const kLegacyStatus[] = { "--", "setup complete" };
+
+// What the old Logger::logEvent appended to /logs.csv
+static std::string legacyLine(const Row &r, uint32_t ts, uint32_t uptimeMs) {
+  char when[24], line[160];
+  time_t t = ts;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(line, sizeof(line), "%s,%lu,%s,%d,%.2f,%.2f,%.2f,%d,%d,%s\n", when, (unsigned long)uptimeMs,
+           kLegacyEvents[(int)r.event], r.pump, r.runtime, r.mlps, r.ml, r.duty, r.dir, kLegacyStatus[(int)r.status]);
+  return line;
+}
+
+// formatCsv output without the columns added since (overshoot_ms)
+static std::string firstColumns(const LogRecord &rec, size_t cols) {
+  char buf[160];
+  size_t n = Logger::formatCsv(rec, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(n > 0);
+  std::string s(buf, n);
+  size_t at = 0;
+  for (size_t c = 0; c < cols && at != std::string::npos; ++c) at = s.find(',', at + (c ? 1 : 0));
+  return (at == std::string::npos) ? s : s.substr(0, at) + "\n";
+}
+
+static std::vector<LogRecord> readAll() {
+  std::vector<LogRecord> out;
+  Logger::flush();
+  LogReader rd;
+  LogRecord r;
+  if (rd.open())
+    for (uint32_t i = 0; rd.read(i, r); ++i) out.push_back(r);
+  rd.close();
+  return out;
+}
+
+// Values the pumps really log (measured runtimes, integrated volumes) and
+// the half-cent cases where float rounding and "%.2f" can disagree
+static std::vector<Row> sampleRows() {
+  std::vector<Row> rows = {
+    { LogEvent::Info, -1, 0.0f, 0.0f, 0.0f, 0, 0, LogStatus::SetupComplete },
+    { LogEvent::Run, 0, 5.0f, 1.25f, 6.25f, 200, 1, LogStatus::None },
+    { LogEvent::Prime, 1, 10.0f, 0.83f, 8.3f, 255, 1, LogStatus::None },
+    { LogEvent::Purge, 2, 3.0f, 1.0f, 3.0f, 128, -1, LogStatus::None },
+    { LogEvent::Stop, 0, 2.0013f, 1.5f, 3.00195f, 200, 0, LogStatus::None },
+    { LogEvent::Stop, 1, 0.125f, 0.005f, 0.015f, 90, 0, LogStatus::None },
+    { LogEvent::Stop, 2, 654.3249f, 12.345f, 1234.565f, 1, 0, LogStatus::None },
+  };
+  for (int i = 0; i < 200; ++i) {
+    float v = i * 0.0137f + 0.005f;
+    rows.push_back({ LogEvent::Stop, i % 3, v, v / 3.0f, v * 7.0f, i, 0, LogStatus::None });
+  }
+  return rows;
+}
+
+void setUp() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::host::setTime(kT0);
+  Logger::begin();
+  Logger::clear();
+}
+
+void tearDown() {}
+
+static void test_header_keeps_legacy_columns() {
+  const char *legacy = "ts,uptime_ms,event,pump,runtime,mlps,ml,duty,dir,status";
+  TEST_ASSERT_EQUAL_STRING_LEN(legacy, Logger::csvHeader(), strlen(legacy));
+  TEST_ASSERT_EQUAL_STRING(",overshoot_ms\n", Logger::csvHeader() + strlen(legacy));
+}
+
+static void test_logged_event_renders_legacy_line() {
+  std::vector<Row> rows = sampleRows();
+  std::vector<std::string> want;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    hal::host::advanceMs(1234);
+    const Row &r = rows[i];
+    Logger::logEvent(r.event, r.pump, r.runtime, r.mlps, r.ml, r.duty, r.dir, r.status);
+    want.push_back(legacyLine(r, (uint32_t)hal::now(), hal::millis()));
+    if (i % 16 == 15) Logger::flush();
+  }
+  std::vector<LogRecord> got = readAll();
+  TEST_ASSERT_EQUAL_UINT32(rows.size(), got.size());
+  for (size_t i = 0; i < got.size(); ++i)
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(want[i].c_str(), firstColumns(got[i], 10).c_str(), want[i].c_str());
+}
+
+// An old /logs.csv is imported at boot and renders back line for line
+static void test_imported_csv_renders_identically() {
+  std::vector<Row> rows = sampleRows();
+  std::string csv = "ts,uptime_ms,event,pump,runtime,mlps,ml,duty,dir,status\n";
+  std::vector<std::string> want;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    want.push_back(legacyLine(rows[i], (uint32_t)kT0 + (uint32_t)i * 3600, 1000 + (uint32_t)i * 77));
+    csv += want.back();
+  }
+  hal::File f = hal::fs().open("/logs.csv", "w");
+  f.write((const uint8_t *)csv.data(), csv.size());
+  f.close();
+
+  Logger::clear();
+  Logger::begin();
+  TEST_ASSERT_FALSE(hal::fs().exists("/logs.csv"));
+  std::vector<LogRecord> got = readAll();
+  TEST_ASSERT_EQUAL_UINT32(rows.size(), got.size());
+  for (size_t i = 0; i < got.size(); ++i) {
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(want[i].c_str(), firstColumns(got[i], 10).c_str(), want[i].c_str());
+    TEST_ASSERT_EQUAL_INT32(0, got[i].overUs);
+  }
+}
+
+// Records written before an upgrade keep their seq order and overshoot 0
+static void test_new_column_after_legacy_ones() {
+  hal::host::advanceMs(500);
+  Logger::logEvent(LogEvent::Stop, 1, 2.0f, 1.0f, 2.0f, 200, 0, LogStatus::None, 1500);
+  std::vector<LogRecord> got = readAll();
+  TEST_ASSERT_EQUAL_UINT32(1, got.size());
+  char buf[160];
+  size_t n = Logger::formatCsv(got[0], buf, sizeof(buf));
+  TEST_ASSERT_EQUAL_STRING("2024-03-01 00:00:00,500,Stop,1,2.00,1.00,2.00,200,0,--,1.500\n", std::string(buf, n).c_str());
+}
+
+// overshoot_ms is integer microseconds printed as milliseconds; the text is
+// what "%.3f" of us / 1000.0 gave
+static void test_overshoot_renders_like_printf() {
+  LogRecord r = {};
+  r.ts = (uint32_t)kT0;
+  r.event = (uint8_t)LogEvent::Stop;
+  char line[200], want[32];
+  for (int32_t us : { 0, 1, 999, 1000, 1234, -1, -500, -1000, -123456, 20000000, INT32_MAX, INT32_MIN + 1 }) {
+    r.overUs = us;
+    snprintf(want, sizeof(want), "%.3f", us / 1000.0);
+    std::string csv(line, Logger::formatCsv(r, line, sizeof(line)));
+    TEST_ASSERT_EQUAL_STRING(want, csv.substr(csv.rfind(',') + 1, csv.size() - csv.rfind(',') - 2).c_str());
+    std::string json(line, Logger::formatJson(r, line, sizeof(line)));
+    TEST_ASSERT_EQUAL_STRING((std::string("\"overshoot_ms\":") + want + "}").c_str(),
+                             json.substr(json.rfind("\"overshoot_ms\"")).c_str());
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_keeps_legacy_columns);
+  RUN_TEST(test_logged_event_renders_legacy_line);
+  RUN_TEST(test_imported_csv_renders_identically);
+  RUN_TEST(test_new_column_after_legacy_ones);
+  RUN_TEST(test_overshoot_renders_like_printf);
+  return UNITY_END();
+}
@@ -0,0 +1,272 @@
+// Binary dose log on the host FS: queue and flush, segment rotation,
+// recovery after a torn write, the sparse time index and the chunked
+// CSV/JSON renderer the HTTP routes use.
+#include <unity.h>
+#include <string>
+#include "Hal.h"
+#include "Logger.h"
+#include "LogStream.h"
+
+static const time_t kT0 = 1709269200;   // 2024-03-01 00:00 EST
+
+// Same defaults as src/Logger.cpp; build_flags may override both
+#ifndef LOG_SEG_RECORDS
+#define LOG_SEG_RECORDS 256
+#endif
+#ifndef LOG_MAX_SEGMENTS
+#define LOG_MAX_SEGMENTS 8
+#endif
+
+// n Run records for pumps 0,1,2,0,... one minute apart from ts0
+static void logRuns(uint32_t n, uint32_t ts0) {
+  for (uint32_t i = 0; i < n; ++i) {
+    hal::host::setTime(ts0 + i * 60);
+    Logger::logEvent(LogEvent::Run, (int)(i % 3), 2.0f, 1.5f, 3.0f, 200, 1);
+    Logger::loop(true);
+  }
+  Logger::flush();
+}
+
+static std::string render(bool json, const LogQuery &q) {
+  LogStream s(json, q);
+  std::string out;
+  uint8_t buf[100];   // small chunks, so lines straddle fill() calls
+  while (size_t n = s.fill(buf, sizeof(buf))) out.append((const char *)buf, n);
+  return out;
+}
+
+static size_t countLines(const std::string &s) {
+  size_t n = 0;
+  for (char c : s) n += (c == '\n');
+  return n;
+}
+
+void setUp() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::host::setTime(kT0);
+  Logger::begin();
+  Logger::clear();
+}
+
+void tearDown() {}
+
+static void test_records_reach_flash_in_batches() {
+  Logger::logEvent(LogEvent::Run, 1, 2.0f, 1.5f, 3.0f, 200, 1);
+  LogReader rd;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(0, rd.size());   // still queued in RAM
+  rd.close();
+  TEST_ASSERT_EQUAL_UINT16(1, Logger::queueStats().depth);
+  hal::host::advanceMs(5000);
+  Logger::loop(true);                        // latency limit reached
+  TEST_ASSERT_EQUAL_UINT16(0, Logger::queueStats().depth);
+
+  LogRecord r;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(1, rd.size());
+  TEST_ASSERT_TRUE(rd.read(0, r));
+  TEST_ASSERT_EQUAL_INT16(1, r.pump);
+  TEST_ASSERT_EQUAL_INT32(300, r.mlC);
+  TEST_ASSERT_EQUAL_UINT16(150, r.mlpsC);
+  TEST_ASSERT_EQUAL_UINT32(kT0, r.ts);
+  rd.close();
+}
+
+// While pumps run only a nearly full queue is flushed
+static void test_busy_loop_defers_flush() {
+  for (int i = 0; i < 20; ++i) Logger::logEvent(LogEvent::Stop, 0, 1.0f, 1.0f, 1.0f, 255, 0);
+  hal::host::advanceMs(10000);
+  Logger::loop(false);
+  TEST_ASSERT_EQUAL_UINT16(20, Logger::queueStats().depth);
+  for (int i = 0; i < 4; ++i) Logger::logEvent(LogEvent::Stop, 0, 1.0f, 1.0f, 1.0f, 255, 0);
+  Logger::loop(false);
+  TEST_ASSERT_EQUAL_UINT16(0, Logger::queueStats().depth);
+}
+
+static void test_forward_and_backward_reads_agree() {
+  logRuns(700, kT0);
+  LogReader rd;
+  LogRecord a, b;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(700, rd.size());
+  for (uint32_t i = 0; i < 700; ++i) {
+    TEST_ASSERT_TRUE(rd.read(i, a));
+    TEST_ASSERT_EQUAL_UINT32(kT0 + i * 60, a.ts);
+  }
+  for (uint32_t i = 700; i-- > 0; ) {
+    TEST_ASSERT_TRUE(rd.readBack(i, b));
+    TEST_ASSERT_EQUAL_UINT32(kT0 + i * 60, b.ts);
+  }
+  TEST_ASSERT_FALSE(rd.read(700, a));
+  rd.close();
+}
+
+// The chain keeps LOG_MAX_SEGMENTS segments; the oldest ones go first
+static void test_rotation_drops_oldest_segment() {
+  const uint32_t n = (LOG_MAX_SEGMENTS + 1) * LOG_SEG_RECORDS + 44;
+  const uint32_t kept = (LOG_MAX_SEGMENTS - 1) * LOG_SEG_RECORDS + 44;
+  logRuns(n, kT0);
+  LogReader rd;
+  LogRecord r;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(kept, rd.size());
+  TEST_ASSERT_TRUE(rd.read(0, r));
+  TEST_ASSERT_EQUAL_UINT32(kT0 + (n - kept) * 60, r.ts);
+  TEST_ASSERT_TRUE(rd.read(rd.size() - 1, r));
+  TEST_ASSERT_EQUAL_UINT32(kT0 + (n - 1) * 60, r.ts);
+  rd.close();
+}
+
+// A record cut short by a power loss is dropped; appending carries on
+static void test_torn_record_is_dropped_at_boot() {
+  logRuns(40, kT0);
+  hal::File f = hal::fs().open("/logs/000.bin", "a");
+  const uint8_t junk[5] = { 1, 2, 3, 4, 5 };
+  f.write(junk, sizeof(junk));
+  f.close();
+  Logger::begin();
+  logRuns(2, kT0 + 40 * 60);
+  LogReader rd;
+  LogRecord r;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(42, rd.size());
+  TEST_ASSERT_TRUE(rd.read(41, r));
+  TEST_ASSERT_EQUAL_UINT32(kT0 + 41 * 60, r.ts);
+  rd.close();
+}
+
+// Flash full in the middle of a batch: the part of a record that made it
+// is cut off, the batch stays queued and later appends stay aligned
+static void test_short_write_keeps_segment_aligned() {
+  logRuns(40, kT0);
+  for (uint32_t i = 40; i < 50; ++i) {
+    hal::host::setTime(kT0 + i * 60);
+    Logger::logEvent(LogEvent::Run, (int)(i % 3), 2.0f, 1.5f, 3.0f, 200, 1);
+  }
+  hal::host::failWritesAfter(5 * sizeof(LogRecord) + 7);
+  Logger::flush();
+  TEST_ASSERT_EQUAL_UINT16(10, Logger::queueStats().depth);
+  hal::File f = hal::fs().open("/logs/000.bin", "r");
+  const size_t headerBytes = f.size() - 40 * sizeof(LogRecord);
+  f.close();
+  TEST_ASSERT_TRUE(headerBytes < sizeof(LogRecord));
+
+  hal::host::failWritesAfter(UINT64_MAX);
+  Logger::flush();
+  TEST_ASSERT_EQUAL_UINT16(0, Logger::queueStats().depth);
+  for (int boot = 0; boot < 2; ++boot) {   // as written, then as recovered at boot
+    LogReader rd;
+    LogRecord r;
+    TEST_ASSERT_TRUE(rd.open());
+    TEST_ASSERT_EQUAL_UINT32(50, rd.size());
+    for (uint32_t i = 0; i < 50; ++i) {
+      TEST_ASSERT_TRUE(rd.read(i, r));
+      TEST_ASSERT_EQUAL_UINT32(kT0 + i * 60, r.ts);
+      TEST_ASSERT_TRUE(rd.readBack(i, r));
+      TEST_ASSERT_EQUAL_UINT32(kT0 + i * 60, r.ts);
+    }
+    rd.close();
+    Logger::begin();
+  }
+}
+
+static void test_index_survives_restart_and_finds_time() {
+  logRuns(1000, kT0);
+  Logger::begin();
+  TEST_ASSERT_TRUE(hal::fs().exists("/logs/index.idx"));
+  for (uint32_t i : { 0u, 1u, 31u, 32u, 500u, 999u }) {
+    uint32_t at = Logger::seekTime(kT0 + i * 60);
+    TEST_ASSERT_TRUE(at <= i);
+    TEST_ASSERT_TRUE(i - at <= 32);   // at most one index step early
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, Logger::seekTime(0));
+}
+
+static void test_tail_start_with_filter() {
+  logRuns(300, kT0);
+  LogReader rd;
+  LogQuery q;
+  q.pump = 1;
+  TEST_ASSERT_TRUE(rd.open());
+  TEST_ASSERT_EQUAL_UINT32(300 - 3 * 10 + 1, Logger::tailStart(rd, 10, q));
+  q.pump = 7;
+  TEST_ASSERT_EQUAL_UINT32(300, Logger::tailStart(rd, 10, q));
+  rd.close();
+}
+
+static void test_stream_renders_filtered_csv_and_json() {
+  logRuns(90, kT0);
+  LogQuery q;
+  q.event = (int16_t)LogEvent::Run;
+  q.from = kT0 + 30 * 60;
+  q.to = kT0 + 59 * 60;
+  std::string csv = render(false, q);
+  TEST_ASSERT_EQUAL_UINT32(1 + 30, countLines(csv));
+  TEST_ASSERT_EQUAL_STRING(Logger::csvHeader(), csv.substr(0, strlen(Logger::csvHeader())).c_str());
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 00:30:00,") != std::string::npos);
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 01:00:00,") == std::string::npos);
+
+  q = LogQuery();
+  q.last = 2;
+  std::string json = render(true, q);
+  TEST_ASSERT_EQUAL_STRING("[\n  {", json.substr(0, 5).c_str());
+  TEST_ASSERT_EQUAL_STRING("}\n]\n", json.substr(json.size() - 4).c_str());
+  TEST_ASSERT_EQUAL_UINT32(4, countLines(json));
+}
+
+// Records still queued in RAM come after the flash ones without the handler
+// flushing them, also when the log task flushes mid-response
+static void test_stream_includes_queued_records() {
+  logRuns(40, kT0);
+  for (uint32_t i = 40; i < 45; ++i) {
+    hal::host::setTime(kT0 + i * 60);
+    Logger::logEvent(LogEvent::Run, (int)(i % 3), 2.0f, 1.5f, 3.0f, 200, 1);
+  }
+  TEST_ASSERT_EQUAL_UINT16(5, Logger::queueStats().depth);
+  LogQuery q;
+  std::string csv = render(false, q);
+  TEST_ASSERT_EQUAL_UINT32(1 + 45, countLines(csv));
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 00:44:00,") != std::string::npos);
+  TEST_ASSERT_EQUAL_UINT16(5, Logger::queueStats().depth);
+
+  q.last = 3;
+  csv = render(false, q);
+  TEST_ASSERT_EQUAL_UINT32(1 + 3, countLines(csv));
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 00:42:00,") != std::string::npos);
+  q.last = 7;
+  csv = render(false, q);
+  TEST_ASSERT_EQUAL_UINT32(1 + 7, countLines(csv));
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 00:38:00,") != std::string::npos);
+  q.pump = 1;   // 40 and 43 queued, 37 on flash
+  q.last = 3;
+  csv = render(false, q);
+  TEST_ASSERT_EQUAL_UINT32(1 + 3, countLines(csv));
+  TEST_ASSERT_TRUE(csv.find("2024-03-01 00:37:00,") != std::string::npos);
+
+  LogStream s(false, LogQuery());
+  std::string out;
+  uint8_t buf[100];
+  out.append((const char *)buf, s.fill(buf, sizeof(buf)));
+  Logger::flush();
+  while (size_t n = s.fill(buf, sizeof(buf))) out.append((const char *)buf, n);
+  TEST_ASSERT_EQUAL_STRING(render(false, LogQuery()).c_str(), out.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_reach_flash_in_batches);
+  RUN_TEST(test_busy_loop_defers_flush);
+  RUN_TEST(test_forward_and_backward_reads_agree);
+  RUN_TEST(test_rotation_drops_oldest_segment);
+  RUN_TEST(test_torn_record_is_dropped_at_boot);
+  RUN_TEST(test_short_write_keeps_segment_aligned);
+  RUN_TEST(test_index_survives_restart_and_finds_time);
+  RUN_TEST(test_tail_start_with_filter);
+  RUN_TEST(test_stream_renders_filtered_csv_and_json);
+  RUN_TEST(test_stream_includes_queued_records);
+  return UNITY_END();
+}
@@ -0,0 +1,209 @@
+// PumpControl and DoseSequencer on the host stand-ins: timer-driven stop
+// edges, ramped doses measured from the recorded PWM, and the sequencer's
+// concurrency, power and incompatibility limits.
+#include <unity.h>
+#include "Hal.h"
+#include "Settings.h"
+#include "PumpControl.h"
+#include "DoseSequencer.h"
+#include "Dosing.h"
+#include "Logger.h"
+
+static const PumpPins kPins[NUM_PUMPS] = { { 12, 13 }, { 14, 15 }, { 4, 5 } };
+
+// Volume actually pumped, integrated from the PWM writes and the flow model
+struct Meter {
+  uint8_t duty[NUM_PUMPS];
+  uint64_t sinceUs[NUM_PUMPS];
+  float ml[NUM_PUMPS];
+  uint8_t starts[NUM_PUMPS];
+};
+static Meter s_meter;
+
+static void onPwm(void *, uint8_t ch, uint8_t duty) {
+  if (ch >= NUM_PUMPS) return;
+  const uint64_t now = hal::host::uptimeUs();
+  s_meter.ml[ch] += flowAt(settings.pump[ch], s_meter.duty[ch]) * (now - s_meter.sinceUs[ch]) / 1e6f;
+  if (!s_meter.duty[ch] && duty) s_meter.starts[ch]++;
+  s_meter.duty[ch] = duty;
+  s_meter.sinceUs[ch] = now;
+}
+
+static void loops(uint32_t ms, uint32_t stepMs = 5) {
+  for (uint32_t t = 0; t < ms; t += stepMs) {
+    pumpCtl.loop();
+    sequencer.loop();
+    hal::host::advanceMs(stepMs);
+  }
+  pumpCtl.loop();
+}
+
+void setUp() {
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::host::setTime(1709269200);
+  s_meter = Meter();
+  hal::host::onPwm(onPwm, nullptr);
+  settings = Settings();
+  Logger::begin();
+  Logger::clear();
+  sequencer = DoseSequencer();
+  pumpCtl = PumpControl();
+  pumpCtl.begin(kPins);
+}
+
+void tearDown() {}
+
+// The stop timer cuts the PWM at the run time even though loop() is not called
+static void test_timed_stop_cuts_on_time() {
+  pumpCtl.run(0, 2);
+  TEST_ASSERT_EQUAL_UINT8(settings.pump[0].duty, hal::host::pwm(0));
+  hal::host::advanceMs(1999);
+  TEST_ASSERT_EQUAL_UINT8(settings.pump[0].duty, hal::host::pwm(0));
+  hal::host::advanceMs(1);
+  TEST_ASSERT_EQUAL_UINT8(0, hal::host::pwm(0));
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(0));   // bookkeeping waits for loop()
+  hal::host::advanceMs(300);
+  pumpCtl.loop();
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(0));
+  TEST_ASSERT_EQUAL_INT32(0, pumpCtl.state(0).overshootUs);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 2.0f, s_meter.ml[0]);
+}
+
+static void test_purge_reverses_direction() {
+  settings.pump[1].dirForward = 1;
+  pumpCtl.purge(1, 1);
+  TEST_ASSERT_FALSE(hal::host::pin(kPins[1].dir));
+  loops(1100);
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(1));
+}
+
+// Ramp and calibration table: the volume the PWM actually delivered matches
+// the request, and so does what PumpControl booked
+static void test_ramped_dose_delivers_target() {
+  PumpConfig &pc = settings.pump[2];
+  pc.duty = 200;
+  pc.riseMs = 400;
+  pc.fallMs = 250;
+  pc.calCount = 3;
+  pc.cal[0] = { 60, 0.2f };
+  pc.cal[1] = { 120, 0.9f };
+  pc.cal[2] = { 200, 1.6f };
+  for (float ml : { 0.3f, 2.0f, 7.5f }) {
+    s_meter.ml[2] = 0.0f;
+    TEST_ASSERT_TRUE(pumpCtl.dose(2, ml));
+    loops(planDose(pc, ml).totalMs() + 100, 1);
+    TEST_ASSERT_FALSE(pumpCtl.isRunning(2));
+    TEST_ASSERT_FLOAT_WITHIN(ml * 0.01f + 0.005f, ml, s_meter.ml[2]);
+    TEST_ASSERT_FLOAT_WITHIN(ml * 0.01f + 0.01f, ml, pumpCtl.state(2).deliveredML);
+  }
+}
+
+// Short doses that are mostly ramp, at a duty low enough that the ramp's
+// 5 ms steps and whole-duty floors are a few percent of the flow: the plan
+// follows the stepped profile, so the PWM still delivers within 1%
+static void test_short_ramped_dose_is_accurate() {
+  PumpConfig &pc = settings.pump[1];
+  pc.duty = 30;
+  pc.mlPerSec = 0.6f;
+  pc.riseMs = 600;
+  pc.fallMs = 450;
+  for (float ml : { 0.05f, 0.15f, 0.3f, 0.6f }) {
+    s_meter.ml[1] = 0.0f;
+    TEST_ASSERT_TRUE(pumpCtl.dose(1, ml));
+    loops(planDose(pc, ml).totalMs() + 100, 1);
+    TEST_ASSERT_FLOAT_WITHIN(ml * 0.01f, ml, s_meter.ml[1]);
+  }
+}
+
+static void test_dose_without_flow_is_refused() {
+  settings.pump[0].mlPerSec = 0.0f;
+  TEST_ASSERT_FALSE(pumpCtl.dose(0, 1.0f));
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(0));
+}
+
+static void test_requests_for_one_pump_merge() {
+  settings.maxConcurrent = 1;
+  sequencer.enqueue(1, 1.0f);
+  sequencer.loop();                  // pump 1 starts
+  sequencer.enqueue(0, 1.0f);        // waits: one pump at a time
+  sequencer.enqueue(0, 0.5f);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.5f, sequencer.pendingMl(0));
+  loops(3000);
+  TEST_ASSERT_EQUAL_UINT8(1, s_meter.starts[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.5f, s_meter.ml[0]);
+}
+
+static void test_concurrency_limit_and_stagger() {
+  settings.maxConcurrent = 2;
+  settings.staggerMs = 250;
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) sequencer.enqueue(p, 2.0f);
+  sequencer.loop();
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(0));
+  loops(200);
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(1));   // stagger
+  loops(60);
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(1));
+  loops(500);
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(2));   // two already running
+  loops(2000);
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(2));
+  loops(3000);
+  for (uint8_t p = 0; p < NUM_PUMPS; ++p) TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.0f, s_meter.ml[p]);
+}
+
+static void test_supply_budget() {
+  settings.maxConcurrent = 3;
+  settings.staggerMs = 0;
+  settings.supplyMa = 900;
+  sequencer.enqueue(0, 1.0f);
+  sequencer.enqueue(1, 1.0f);
+  sequencer.loop();
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(0));
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(1));   // 2 x 500 mA > 900 mA
+  loops(1100);
+  TEST_ASSERT_TRUE(pumpCtl.isRunning(1));
+}
+
+// A pump that alone draws more than the supply can never start: its job is
+// dropped instead of waiting forever
+static void test_pump_over_supply_is_dropped() {
+  settings.supplyMa = 400;
+  sequencer.enqueue(0, 1.0f);
+  sequencer.loop();
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(0));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, sequencer.pendingMl(0));
+  loops(1100);
+  TEST_ASSERT_EQUAL_UINT8(0, s_meter.starts[0]);
+}
+
+static void test_incompatible_gap() {
+  settings.staggerMs = 0;
+  settings.incompatGapSec = 60;
+  settings.pump[0].incompatMask = 1u << 1;
+  sequencer.enqueue(0, 1.0f);
+  sequencer.enqueue(1, 1.0f);
+  loops(1100);
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(0));
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(1));
+  loops(58000, 100);
+  TEST_ASSERT_FALSE(pumpCtl.isRunning(1));
+  loops(2100, 100);
+  TEST_ASSERT_EQUAL_UINT8(1, s_meter.starts[1]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_timed_stop_cuts_on_time);
+  RUN_TEST(test_purge_reverses_direction);
+  RUN_TEST(test_ramped_dose_delivers_target);
+  RUN_TEST(test_short_ramped_dose_is_accurate);
+  RUN_TEST(test_dose_without_flow_is_refused);
+  RUN_TEST(test_requests_for_one_pump_merge);
+  RUN_TEST(test_concurrency_limit_and_stagger);
+  RUN_TEST(test_supply_budget);
+  RUN_TEST(test_pump_over_supply_is_dropped);
+  RUN_TEST(test_incompatible_gap);
+  return UNITY_END();
+}
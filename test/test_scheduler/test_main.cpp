@@ -0,0 +1,234 @@
+// Scheduler on the host clock: daily slots, persisted fire state across
+// reboots, catch-up policies and DST. Doses go through the real sequencer
+// and pump control; what happened is read back from the dose log.
+#include <unity.h>
+#include "Hal.h"
+#include "Settings.h"
+#include "Scheduler.h"
+#include "DoseSequencer.h"
+#include "PumpControl.h"
+#include "Logger.h"
+
+static const PumpPins kPins[NUM_PUMPS] = { { 12, 13 }, { 14, 15 }, { 4, 5 } };
+static const time_t kMar1 = 1709269200;   // 2024-03-01 00:00 EST
+static const time_t kMar9 = 1709960400;   // 2024-03-09 00:00 EST, DST starts the next night
+static const uint32_t kH = 3600;
+
+// Run the loop tasks as main.cpp does until the wall clock reaches `until`.
+// Idle stretches jump straight to the next scheduled event.
+static void runUntil(time_t until) {
+  while (hal::now() < until) {
+    pumpCtl.loop();
+    scheduler.loop();
+    sequencer.loop();
+    Logger::loop(!pumpCtl.anyRunning());
+    bool busy = pumpCtl.anyRunning();
+    for (uint8_t p = 0; p < NUM_PUMPS; ++p) busy |= sequencer.pendingMl(p) > 0.0f;
+    uint64_t stepMs = 5;
+    if (!busy) {
+      stepMs = (uint64_t)(until - hal::now()) * 1000;
+      uint32_t next = scheduler.msUntilNext();
+      if (next < stepMs) stepMs = next;
+      if (stepMs < 1) stepMs = 1;
+    }
+    hal::host::advanceUs(stepMs * 1000);
+  }
+}
+
+// Power cycle: RAM state is gone, files stay; the wall clock moves on by offSec
+static void reboot(uint32_t offSec) {
+  Logger::flush();
+  time_t wall = hal::now() + offSec;
+  hal::host::reboot();
+  hal::host::setTime(wall);
+  scheduler = Scheduler();
+  sequencer = DoseSequencer();
+  pumpCtl = PumpControl();
+  Logger::begin();
+  pumpCtl.begin(kPins);
+  scheduler.begin();
+}
+
+struct Runs {
+  uint8_t count;
+  float ml;
+  uint32_t ts[16];
+};
+
+static Runs runsOf(uint8_t pump) {
+  Runs out = {};
+  Logger::flush();
+  LogReader rd;
+  LogRecord r;
+  if (rd.open())
+    for (uint32_t i = 0; rd.read(i, r); ++i) {
+      if (r.event != (uint8_t)LogEvent::Run || r.pump != pump) continue;
+      if (out.count < 16) out.ts[out.count] = r.ts;
+      out.count++;
+      out.ml += r.mlC / 100.0f;
+    }
+  rd.close();
+  return out;
+}
+
+static void setSlots(uint8_t pump, uint32_t sec0, float ml0, uint32_t sec1 = 0, float ml1 = 0.0f) {
+  PumpConfig &pc = settings.pump[pump];
+  pc.timesCount = ml1 > 0.0f ? 2 : 1;
+  pc.timesSec[0] = sec0;
+  pc.doseML[0] = ml0;
+  pc.timesSec[1] = sec1;
+  pc.doseML[1] = ml1;
+}
+
+void setUp() {
+  setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0/2", 1);
+  tzset();
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  hal::host::setTime(kMar1);
+  settings = Settings();
+  settings.pump[0].mlPerSec = 2.0f;
+  Logger::begin();
+  Logger::clear();
+  scheduler = Scheduler();
+  sequencer = DoseSequencer();
+  pumpCtl = PumpControl();
+  pumpCtl.begin(kPins);
+  scheduler.begin();
+}
+
+void tearDown() {}
+
+static void test_daily_slots_fire_once_a_day() {
+  setSlots(0, 8 * kH, 1.5f, 20 * kH, 2.0f);
+  runUntil(kMar1 + 3 * 24 * kH);
+  Runs r = runsOf(0);
+  TEST_ASSERT_EQUAL_UINT8(6, r.count);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 3 * 3.5f, r.ml);
+  struct tm tm;
+  time_t t = r.ts[0];
+  localtime_r(&t, &tm);
+  TEST_ASSERT_EQUAL_INT(8, tm.tm_hour);
+  TEST_ASSERT_EQUAL_UINT32(0, runsOf(1).count);
+}
+
+static void test_next_run_and_wait_are_exact() {
+  setSlots(0, 8 * kH, 1.0f);
+  runUntil(kMar1 + 6 * kH);
+  TEST_ASSERT_EQUAL_UINT32(2 * kH, scheduler.nextRunSec(0));
+  TEST_ASSERT_EQUAL_UINT32(2 * kH * 1000, scheduler.msUntilNext());
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, scheduler.nextRunSec(1));
+}
+
+static void test_reboot_after_a_dose_does_not_repeat_it() {
+  setSlots(0, 8 * kH, 1.0f);
+  runUntil(kMar1 + 8 * kH + 60);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(0).count);
+  reboot(5);
+  runUntil(kMar1 + 12 * kH);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(0).count);
+}
+
+// Power lost while a due dose still waits in the sequencer (one pump at a
+// time, pump 0 busy for 50 s): that dose was never started, so it is still
+// owed after the reboot; pump 0's started dose is not repeated
+static void test_reboot_while_dose_waits_keeps_it() {
+  settings.maxConcurrent = 1;
+  settings.pump[1].mlPerSec = 1.0f;
+  setSlots(0, 8 * kH, 100.0f);
+  setSlots(1, 8 * kH, 1.0f);
+  runUntil(kMar1 + 8 * kH + 20);
+  TEST_ASSERT_TRUE(sequencer.pendingMl(1) > 0.0f);
+  TEST_ASSERT_EQUAL_UINT8(0, runsOf(1).count);
+  reboot(5);
+  runUntil(kMar1 + 9 * kH);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(1).count);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.0f, runsOf(1).ml);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(0).count);
+  reboot(5);
+  runUntil(kMar1 + 10 * kH);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(1).count);
+}
+
+// Off from 07:00 to 09:00 on the second day: the 08:00 dose is past the
+// grace window when the device comes back
+static float missedDoseWith(CatchUpPolicy policy) {
+  settings.catchUp = policy;
+  setSlots(0, 8 * kH, 2.0f, 20 * kH, 2.0f);
+  runUntil(kMar1 + 31 * kH);
+  TEST_ASSERT_EQUAL_UINT8(2, runsOf(0).count);
+  reboot(2 * kH);
+  runUntil(kMar1 + 33 * kH + 600);
+  Runs r = runsOf(0);
+  return r.ml - 4.0f;
+}
+
+static void test_missed_dose_skip_policy() {
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, missedDoseWith(CatchUpPolicy::Skip));
+}
+
+static void test_missed_dose_late_policy() {
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.0f, missedDoseWith(CatchUpPolicy::Late));
+}
+
+// One hour (plus the boot second) late out of a 12 h gap to the next slot
+static void test_missed_dose_scaled_policy() {
+  TEST_ASSERT_FLOAT_WITHIN(0.02f, 2.0f * (1.0f - 1.0f / 12.0f), missedDoseWith(CatchUpPolicy::Scaled));
+}
+
+static void test_no_history_is_not_caught_up() {
+  settings.catchUp = CatchUpPolicy::Late;
+  setSlots(0, 8 * kH, 1.0f);
+  hal::host::setTime(kMar1 + 10 * kH);   // first boot after the slot: nothing to owe
+  scheduler = Scheduler();
+  scheduler.begin();
+  runUntil(kMar1 + 12 * kH);
+  TEST_ASSERT_EQUAL_UINT8(0, runsOf(0).count);
+}
+
+// 2024-03-10 02:00 EST -> 03:00 EDT; an 08:00 slot stays at 08:00 local
+static void test_dst_keeps_wall_clock_time() {
+  setSlots(0, 8 * kH, 1.0f);
+  hal::host::setTime(kMar9);
+  scheduler = Scheduler();
+  scheduler.begin();
+  runUntil(kMar9 + 3 * 24 * kH);
+  Runs r = runsOf(0);
+  TEST_ASSERT_EQUAL_UINT8(3, r.count);
+  for (uint8_t i = 0; i < 3; ++i) {
+    struct tm tm;
+    time_t t = r.ts[i];
+    localtime_r(&t, &tm);
+    TEST_ASSERT_EQUAL_INT(8, tm.tm_hour);
+    TEST_ASSERT_EQUAL_INT(0, tm.tm_min);
+  }
+}
+
+// Changing one pump's schedule re-plans only that pump
+static void test_invalidate_one_pump() {
+  setSlots(0, 8 * kH, 1.0f);
+  setSlots(1, 9 * kH, 1.0f);
+  runUntil(kMar1 + 6 * kH);
+  settings.pump[1].timesSec[0] = 7 * kH;
+  scheduler.invalidate(1);
+  runUntil(kMar1 + 7 * kH + 60);
+  TEST_ASSERT_EQUAL_UINT8(1, runsOf(1).count);
+  TEST_ASSERT_EQUAL_UINT8(0, runsOf(0).count);
+  TEST_ASSERT_EQUAL_UINT32(kH - 60, scheduler.nextRunSec(0));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_daily_slots_fire_once_a_day);
+  RUN_TEST(test_next_run_and_wait_are_exact);
+  RUN_TEST(test_reboot_after_a_dose_does_not_repeat_it);
+  RUN_TEST(test_reboot_while_dose_waits_keeps_it);
+  RUN_TEST(test_missed_dose_skip_policy);
+  RUN_TEST(test_missed_dose_late_policy);
+  RUN_TEST(test_missed_dose_scaled_policy);
+  RUN_TEST(test_no_history_is_not_caught_up);
+  RUN_TEST(test_dst_keeps_wall_clock_time);
+  RUN_TEST(test_invalidate_one_pump);
+  return UNITY_END();
+}
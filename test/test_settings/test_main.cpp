@@ -0,0 +1,112 @@
+// SettingsStore images: round trip, damaged files, and element counts that
+// do not fit the arrays of this build; settings uploads that are rejected.
+#include <unity.h>
+#include "Hal.h"
+#include "Settings.h"
+#include "SettingsStore.h"
+
+void setUp() {
+  hal::host::quiet(true);
+  hal::host::reset();
+  hal::host::wipeFs();
+  settings = Settings();
+}
+
+void tearDown() {}
+
+static void test_pump_section_round_trip() {
+  PumpConfig &pc = settings.pump[1];
+  pc.mlPerSec = 1.75f;
+  pc.timesCount = 2;
+  pc.timesSec[1] = 20 * 3600;
+  pc.doseML[1] = 2.5f;
+  pc.calCount = 1;
+  pc.cal[0].duty = 120;
+  TEST_ASSERT_TRUE(SettingsStore::save(1));
+  settings = Settings();
+  TEST_ASSERT_TRUE(SettingsStore::load(1));
+  TEST_ASSERT_EQUAL_FLOAT(1.75f, settings.pump[1].mlPerSec);
+  TEST_ASSERT_EQUAL_UINT8(2, settings.pump[1].timesCount);
+  TEST_ASSERT_EQUAL_UINT32(20 * 3600, settings.pump[1].timesSec[1]);
+  TEST_ASSERT_EQUAL_FLOAT(2.5f, settings.pump[1].doseML[1]);
+  TEST_ASSERT_EQUAL_UINT8(1, settings.pump[1].calCount);
+  TEST_ASSERT_EQUAL_UINT8(120, settings.pump[1].cal[0].duty);
+}
+
+// A CRC-valid image whose counts exceed the arrays loads with the counts cut
+static void test_counts_are_capped_on_load() {
+  settings.pump[0].timesCount = 200;
+  settings.pump[0].calCount = MAX_CAL_POINTS + 1;
+  TEST_ASSERT_TRUE(SettingsStore::save(0));
+  settings = Settings();
+  TEST_ASSERT_TRUE(SettingsStore::load(0));
+  TEST_ASSERT_EQUAL_UINT8(MAX_TIMES_PER_DAY, settings.pump[0].timesCount);
+  TEST_ASSERT_EQUAL_UINT8(MAX_CAL_POINTS, settings.pump[0].calCount);
+}
+
+static void test_damaged_image_changes_nothing() {
+  settings.pump[2].timesCount = 3;
+  TEST_ASSERT_TRUE(SettingsStore::save(2));
+  hal::File f = hal::fs().open("/cfg_p2.bin", "r+");
+  f.seek(f.size() - 1, SeekSet);
+  uint8_t b = 0x5A;
+  f.write(&b, 1);
+  f.close();
+  settings = Settings();
+  settings.pump[2].timesCount = 1;
+  TEST_ASSERT_FALSE(SettingsStore::load(2));
+  TEST_ASSERT_EQUAL_UINT8(1, settings.pump[2].timesCount);
+}
+
+// A rejected upload leaves every setting as it was
+static void test_rejected_upload_changes_nothing() {
+  strlcpy(settings.hostname, "doser", sizeof(settings.hostname));
+  settings.graceSec = 60;
+  JsonDocument doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"hostname\":\"other\",\"graceSec\":5,\"catchUp\":\"never\"}"));
+  String err;
+  TEST_ASSERT_FALSE(settingsFromJson(doc.as<JsonVariantConst>(), err));
+  TEST_ASSERT_EQUAL_STRING("bad catchUp", err.c_str());
+  TEST_ASSERT_EQUAL_STRING("doser", settings.hostname);
+  TEST_ASSERT_EQUAL_UINT16(60, settings.graceSec);
+
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"supplyMa\":800,\"pumps\":[{\"idx\":2,\"currentMa\":900}]}"));
+  TEST_ASSERT_FALSE(settingsFromJson(doc.as<JsonVariantConst>(), err));
+  TEST_ASSERT_EQUAL_STRING("currentMa over supplyMa", err.c_str());
+  TEST_ASSERT_EQUAL_UINT16(0, settings.supplyMa);
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"supplyMa\":400}"));
+  TEST_ASSERT_FALSE(settingsFromJson(doc.as<JsonVariantConst>(), err));
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"supplyMa\":800,\"pumps\":[{\"idx\":2,\"currentMa\":700}]}"));
+  TEST_ASSERT_TRUE(settingsFromJson(doc.as<JsonVariantConst>(), err));
+  TEST_ASSERT_EQUAL_UINT16(700, settings.pump[2].currentMa);
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"currentMa\":801}"));
+  PumpConfig pc;
+  TEST_ASSERT_FALSE(pumpPatchFromJson(1, doc.as<JsonVariantConst>(), pc, err));
+}
+
+// A pump patch becomes current only once its section is on flash
+static void test_pump_patch_applies_after_save() {
+  JsonDocument doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, "{\"duty\":99}"));
+  String err;
+  PumpConfig pc;
+  TEST_ASSERT_TRUE(pumpPatchFromJson(0, doc.as<JsonVariantConst>(), pc, err));
+  TEST_ASSERT_EQUAL_UINT8(99, pc.duty);
+  TEST_ASSERT_EQUAL_UINT8(Settings().pump[0].duty, settings.pump[0].duty);
+  hal::host::failWritesAfter(0);
+  TEST_ASSERT_FALSE(settingsSavePump(0, pc));
+  TEST_ASSERT_EQUAL_UINT8(Settings().pump[0].duty, settings.pump[0].duty);
+  hal::host::reset();
+  TEST_ASSERT_TRUE(settingsSavePump(0, pc));
+  TEST_ASSERT_EQUAL_UINT8(99, settings.pump[0].duty);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_pump_section_round_trip);
+  RUN_TEST(test_counts_are_capped_on_load);
+  RUN_TEST(test_damaged_image_changes_nothing);
+  RUN_TEST(test_rejected_upload_changes_nothing);
+  RUN_TEST(test_pump_patch_applies_after_save);
+  return UNITY_END();
+}
@@ -0,0 +1,92 @@
+// HostSim: the firmware's dosing path booted from test_sim/settings.json
+// (three pumps, all due at 08:00, one at a time, pumps 0 and 1
+// incompatible) and run on the fake clock with injected faults.
+#include <unity.h>
+#include <string>
+#include "host/HostSim.h"
+
+static const time_t kMar1 = 1709269200;   // 2024-03-01 00:00 EST
+static const uint32_t kH = 3600;
+static HostSim s_sim;
+
+static std::string fixture() {
+  std::string dir = __FILE__;
+  return dir.substr(0, dir.find_last_of('/') + 1) + "settings.json";
+}
+
+void setUp() {
+  hal::host::quiet(true);
+  TEST_ASSERT_TRUE(s_sim.loadFile(fixture().c_str()));
+}
+
+void tearDown() {}
+
+static void test_settings_file_is_imported() {
+  TEST_ASSERT_FALSE(hal::fs().exists("/settings.json"));
+  TEST_ASSERT_TRUE(hal::fs().exists("/cfg_sys.bin"));
+  TEST_ASSERT_EQUAL_UINT8(1, settings.maxConcurrent);
+  TEST_ASSERT_EQUAL_UINT8(2, settings.pump[1].calCount);
+  TEST_ASSERT_EQUAL_UINT8(2, settings.pump[2].timesCount);
+  TEST_ASSERT_FALSE(s_sim.loadJson("{\"pumps\":[}"));
+}
+
+// Across the DST change on 2024-03-10; the sequencer spreads the 08:00
+// doses out but every day gets its volume
+static void test_month_doses_as_configured() {
+  TEST_ASSERT_TRUE(s_sim.run(kMar1, 31));
+  TEST_ASSERT_EQUAL_UINT16(0, s_sim.mismatched());
+  TEST_ASSERT_EQUAL_size_t(31, s_sim.days().size());
+  for (const HostSim::Day &d : s_sim.days()) {
+    TEST_ASSERT_EQUAL_UINT16(2, d.runs[0]);
+    TEST_ASSERT_EQUAL_UINT16(1, d.runs[1]);
+    TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 12.5f, d.dosedMl[2]);
+  }
+}
+
+// Power lost 2 s into the 08:00 burst: pump 0's run is cut and not
+// repeated, the doses still waiting in the sequencer are
+static void test_reboot_during_burst() {
+  TEST_ASSERT_TRUE(s_sim.run(kMar1, 2, "reboot@28802:5"));
+  TEST_ASSERT_EQUAL_UINT16(1, s_sim.reboots());
+  const HostSim::Day &d = s_sim.days()[0];
+  TEST_ASSERT_TRUE(d.dosedMl[0] < 10.0f - 1.0f);
+  TEST_ASSERT_EQUAL_UINT16(2, d.runs[0]);
+  TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 3.0f, d.dosedMl[1]);
+  TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 12.5f, d.dosedMl[2]);
+  TEST_ASSERT_EQUAL_UINT16(1, s_sim.mismatched());
+}
+
+// Off from 07:00 to 09:00 on the second day with the skip policy: exactly
+// the 08:00 doses are missing from that day
+static void test_missed_slot_is_skipped() {
+  TEST_ASSERT_TRUE(s_sim.run(kMar1, 3, "reboot@111600:7200"));
+  const HostSim::Day &d = s_sim.days()[1];
+  TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 5.0f, d.dosedMl[0]);
+  TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 0.0f, d.dosedMl[1]);
+  TEST_ASSERT_FLOAT_WITHIN(HostSim::kTolMl, 2.5f, d.dosedMl[2]);
+  TEST_ASSERT_EQUAL_UINT16(3, s_sim.mismatched());
+}
+
+// Clock stepped back over the doses already given, and a loop stall across
+// a stop time: nothing repeats, nothing is lost
+static void test_clock_step_and_stall() {
+  TEST_ASSERT_TRUE(s_sim.run(kMar1, 3, "jump@118800:-7200,stall@201601:30"));
+  TEST_ASSERT_EQUAL_UINT16(0, s_sim.mismatched());
+  TEST_ASSERT_EQUAL_UINT16(1, s_sim.days()[1].runs[1]);
+}
+
+static void test_bad_inject_spec() {
+  TEST_ASSERT_FALSE(s_sim.run(kMar1, 1, "reboot@x"));
+  TEST_ASSERT_FALSE(s_sim.run(kMar1, 1, "jump@10:90000"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_settings_file_is_imported);
+  RUN_TEST(test_month_doses_as_configured);
+  RUN_TEST(test_reboot_during_burst);
+  RUN_TEST(test_missed_slot_is_skipped);
+  RUN_TEST(test_clock_step_and_stall);
+  RUN_TEST(test_bad_inject_spec);
+  return UNITY_END();
+}